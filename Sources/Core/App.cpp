@@ -185,40 +185,38 @@ void App::executeRasterizer() {
         return out;
     };
 
-    FragmentShader fragShader;
+    mRasterizer.mpPipeline->beginFrame();
+    mRasterizer.mpPipeline->setDebugPixel(mSelectedPixel);
 
+    // Draw with the concrete shader types so they are inlined into the batch loops
     switch (mVisualizeMode) {
         case VisualizeMode::Depth: {
-            fragShader = [data](FragIn fragIn, const GraphicsContextData& context) {
+            auto fragShader = [data](FragIn fragIn, const GraphicsContextData& context) {
                 float depth = fragIn.rasterPosition.z;
                 float linearDepth = data.nearZ * data.farZ / (data.farZ + depth * (data.nearZ - data.farZ));
                 return float4(float3(linearDepth), 1.f);
             };
+            mRasterizer.mpPipeline->draw(*mpModelVao, *mpBVH, vertexShader, fragShader);
         } break;
 
         case VisualizeMode::Normal: {
-            fragShader = [](FragIn fragIn, const GraphicsContextData& context) {
+            auto fragShader = [](FragIn fragIn, const GraphicsContextData& context) {
                 float3 normal = fragIn.normal;
                 normal = normal * float3(0.5) + float3(0.5);
                 return float4(normal, 1.f);
             };
+            mRasterizer.mpPipeline->draw(*mpModelVao, *mpBVH, vertexShader, fragShader);
         } break;
 
         case VisualizeMode::PseudoPrimitiveColor: {
-            auto select = mSelectedPixel;
-            fragShader = [&, select](FragIn fragIn, const GraphicsContextData& context) {
-                if (select == int2(context.sampleCrd)) {
-                    mRasterizerDebugData = context.debugData;
-                }
-
+            auto fragShader = [](FragIn fragIn, const GraphicsContextData& context) {
                 return float4(pseudoColor(context.primitiveId), 1.f);
             };
+            mRasterizer.mpPipeline->draw(*mpModelVao, *mpBVH, vertexShader, fragShader);
         } break;
     }
 
-    mRasterizer.mpPipeline->beginFrame();
-
-    mRasterizer.mpPipeline->draw(*mpModelVao, *mpBVH, vertexShader, fragShader);
+    mRasterizer.mpPipeline->endFrame();
 }
 
 void App::blitFrameBuffer() const {
@@ -332,12 +330,13 @@ void App::renderUI() {
     if (ImGui::CollapsingHeader("Pixel Debug", ImGuiTreeNodeFlags_DefaultOpen) &&
         mRasterizer.mpPipeline->getRasterMode() == RasterMode::ScanLineZBuffer) {
         ImGui::Text("Pixel: (%d, %d)", mSelectedPixel.x, mSelectedPixel.y);
+        mRasterizer.mpPipeline->getDebugData(mRasterizerDebugData);
         std::string item0Str = fmt::format("Primitive ID: {}\n Start x: {}, dx: {}, dy: {}",
-                                           mRasterizerDebugData.activeEdgePair[0].primitive.id, mRasterizerDebugData.activeEdgePair[0].x0,
+                                           mRasterizerDebugData.activeEdgePair[0].primitiveId, mRasterizerDebugData.activeEdgePair[0].x0,
                                            mRasterizerDebugData.activeEdgePair[0].dx, mRasterizerDebugData.activeEdgePair[0].dy);
 
         std::string item1Str = fmt::format("Primitive ID: {}\n Start x: {}, dx: {}, dy: {}",
-                                           mRasterizerDebugData.activeEdgePair[1].primitive.id, mRasterizerDebugData.activeEdgePair[1].x0,
+                                           mRasterizerDebugData.activeEdgePair[1].primitiveId, mRasterizerDebugData.activeEdgePair[1].x0,
                                            mRasterizerDebugData.activeEdgePair[1].dx, mRasterizerDebugData.activeEdgePair[1].dy);
         ImGui::Text("Edge item 0:\n%s", item0Str.c_str());
         ImGui::Text("Edge item 1:\n%s", item1Str.c_str());
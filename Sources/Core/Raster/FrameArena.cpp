@@ -0,0 +1,54 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "Core/Error.h"
+
+namespace Rastery {
+FrameArena::FrameArena(size_t blockSize) : mBlockSize(blockSize) {}
+
+void FrameArena::reset() {
+    // Fold the blocks of a frame that overflowed into a single one
+    if (mBlocks.size() > 1) {
+        size_t size = std::max(capacity(), mUsedBytes);
+        mBlocks.clear();
+        mBlocks.push_back({std::make_unique_for_overwrite<std::byte[]>(size), size});
+    }
+    mCurrentBlock = 0;
+    mOffset = 0;
+    mUsedBytes = 0;
+}
+
+size_t FrameArena::capacity() const {
+    size_t size = 0;
+    for (const auto& block : mBlocks) size += block.size;
+    return size;
+}
+
+void* FrameArena::allocateBytes(size_t size, size_t alignment) {
+    RASTERY_ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    while (true) {
+        if (mCurrentBlock < mBlocks.size()) {
+            auto& block = mBlocks[mCurrentBlock];
+            auto address = reinterpret_cast<uintptr_t>(block.pData.get());
+            size_t offset = ((address + mOffset + alignment - 1) & ~(alignment - 1)) - address;
+            if (offset + size <= block.size) {
+                mUsedBytes += offset + size - mOffset;
+                mOffset = offset + size;
+                return block.pData.get() + offset;
+            }
+            if (mCurrentBlock + 1 < mBlocks.size()) {
+                mCurrentBlock++;
+                mOffset = 0;
+                continue;
+            }
+        }
+
+        size_t blockSize = std::max(mBlockSize, size + alignment);
+        mBlocks.push_back({std::make_unique_for_overwrite<std::byte[]>(blockSize), blockSize});
+        mCurrentBlock = mBlocks.size() - 1;
+        mOffset = 0;
+    }
+}
+}  // namespace Rastery
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace Rastery {
+/** Bump allocator for per frame temporary arrays, everything is released at once by reset().
+ * Memory is grow-only, reset() keeps it and folds multiple blocks into one that fits the whole previous frame,
+ * so a steady workload stops allocating after the first frames.
+ * Not thread safe, allocate from the thread driving the pipeline and hand the arrays to workers.
+ */
+class FrameArena {
+   public:
+    explicit FrameArena(size_t blockSize = size_t(1) << 20);
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    /** Allocate a default initialized array, destructors are never run so T must be trivially destructible.
+     */
+    template <typename T>
+    [[nodiscard]] std::span<T> allocate(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena memory is released without running destructors");
+        T* p = static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+        std::uninitialized_default_construct_n(p, count);
+        return {p, count};
+    }
+
+    /** Allocate an array with every element set to value.
+     */
+    template <typename T>
+    [[nodiscard]] std::span<T> allocate(size_t count, const T& value) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena memory is released without running destructors");
+        T* p = static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+        std::uninitialized_fill_n(p, count, value);
+        return {p, count};
+    }
+
+    /** Release all allocations, every array handed out before is invalidated.
+     */
+    void reset();
+
+    [[nodiscard]] size_t usedBytes() const { return mUsedBytes; }
+
+    [[nodiscard]] size_t capacity() const;
+
+   private:
+    void* allocateBytes(size_t size, size_t alignment);
+
+    struct Block {
+        std::unique_ptr<std::byte[]> pData;
+        size_t size;
+    };
+
+    std::vector<Block> mBlocks;
+    size_t mBlockSize;
+    size_t mCurrentBlock = 0;
+    size_t mOffset = 0;     ///< Bump offset in the current block
+    size_t mUsedBytes = 0;  ///< Bytes handed out since the last reset, alignment padding included
+};
+}  // namespace Rastery
@@ -0,0 +1,122 @@
+#include "HiZBuffer.h"
+
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "Core/Error.h"
+
+namespace Rastery {
+void HiZBuffer::resize(int width, int height) {
+    if (width == mWidth && height == mHeight) return;
+    RASTERY_ASSERT(width > 0 && height > 0);
+    mWidth = width;
+    mHeight = height;
+
+    mLevels.clear();
+    size_t texelCount = 0;
+    int2 size = (int2(width, height) + kTileSize - 1) >> kTileSizeLog2;
+    while (true) {
+        mLevels.push_back({size.x, size.y, texelCount});
+        texelCount += size_t(size.x) * size.y;
+        if (size.x == 1 && size.y == 1) break;
+        size = (size + 1) / 2;
+    }
+    mTexels.resize(texelCount);
+    mDirtyTiles.assign(size_t(mLevels[0].width) * mLevels[0].height, 0);
+    mDirtyMin = int2(0);
+    mDirtyMax = int2(-1);
+    mPendingUpdateCount = 0;
+    mValid = false;
+}
+
+void HiZBuffer::rebuild(CpuTexture& depthTexture) {
+    std::fill(mDirtyTiles.begin(), mDirtyTiles.end(), uint8_t(1));
+    mDirtyMin = int2(0);
+    mDirtyMax = int2(mLevels[0].width - 1, mLevels[0].height - 1);
+    update(depthTexture);
+    mValid = true;
+}
+
+void HiZBuffer::markDirty(std::pair<uint2, uint2> pixelRange) {
+    int2 tileMax(mLevels[0].width - 1, mLevels[0].height - 1);
+    int2 tileMin = glm::min(int2(pixelRange.first) >> kTileSizeLog2, tileMax);
+    int2 tileEnd = glm::min(int2(pixelRange.second) >> kTileSizeLog2, tileMax);
+    if (tileMin.x > tileEnd.x || tileMin.y > tileEnd.y) return;
+    for (int ty = tileMin.y; ty <= tileEnd.y; ty++) {
+        std::fill_n(&mDirtyTiles[size_t(ty) * mLevels[0].width + tileMin.x], tileEnd.x - tileMin.x + 1, uint8_t(1));
+    }
+    mDirtyMin = mDirtyMax.x < mDirtyMin.x ? tileMin : glm::min(mDirtyMin, tileMin);
+    mDirtyMax = glm::max(mDirtyMax, tileEnd);
+    mPendingUpdateCount++;
+}
+
+void HiZBuffer::update(CpuTexture& depthTexture) {
+    mPendingUpdateCount = 0;
+    if (mDirtyMax.x < mDirtyMin.x) return;
+    RASTERY_ASSERT(depthTexture.getDesc().width == mWidth && depthTexture.getDesc().height == mHeight);
+
+    // Level 0, reduce the pixels of the dirty tiles only
+    tbb::parallel_for(mDirtyMin.y, mDirtyMax.y + 1, [&](int ty) {
+        for (int tx = mDirtyMin.x; tx <= mDirtyMax.x; tx++) {
+            uint8_t& dirty = mDirtyTiles[size_t(ty) * mLevels[0].width + tx];
+            if (!dirty) continue;
+            dirty = 0;
+
+            int2 pixelMin = int2(tx, ty) * kTileSize;
+            int2 pixelEnd = glm::min(pixelMin + kTileSize, int2(mWidth, mHeight));
+            float nearest = std::numeric_limits<float>::infinity(), farthest = -std::numeric_limits<float>::infinity();
+            for (int y = pixelMin.y; y < pixelEnd.y; y++) {
+                const float* pRow = depthTexture.fetch<float>(0u, uint32_t(y)).ptr();
+                for (int x = pixelMin.x; x < pixelEnd.x; x++) {
+                    nearest = std::min(nearest, pRow[x]);
+                    farthest = std::max(farthest, pRow[x]);
+                }
+            }
+            texel(0, tx, ty) = float2(nearest, farthest);
+        }
+    });
+
+    // Upper levels, rebuild the texels above the dirty rectangle from their 2x2 children
+    int2 dirtyMin = mDirtyMin, dirtyMax = mDirtyMax;
+    for (int level = 1; level < int(mLevels.size()); level++) {
+        dirtyMin >>= 1;
+        dirtyMax >>= 1;
+        int2 childMax(mLevels[level - 1].width - 1, mLevels[level - 1].height - 1);
+        for (int y = dirtyMin.y; y <= dirtyMax.y; y++) {
+            for (int x = dirtyMin.x; x <= dirtyMax.x; x++) {
+                int2 c0 = int2(x, y) * 2;
+                int2 c1 = glm::min(c0 + 1, childMax);
+                float2 t0 = texel(level - 1, c0.x, c0.y), t1 = texel(level - 1, c1.x, c0.y);
+                float2 t2 = texel(level - 1, c0.x, c1.y), t3 = texel(level - 1, c1.x, c1.y);
+                texel(level, x, y) = float2(std::min({t0.x, t1.x, t2.x, t3.x}), std::max({t0.y, t1.y, t2.y, t3.y}));
+            }
+        }
+    }
+    mDirtyMin = int2(0);
+    mDirtyMax = int2(-1);
+}
+
+HiZResult HiZBuffer::test(const AABB& vpBounds) const {
+    RASTERY_ASSERT(mValid);
+    float2 pixelLimit = float2(mWidth, mHeight) - 1.f;
+    int2 tileMin = int2(glm::clamp(glm::floor(float2(vpBounds.minPoint)), float2(0.f), pixelLimit)) >> kTileSizeLog2;
+    int2 tileMax = int2(glm::clamp(glm::floor(float2(vpBounds.maxPoint)), float2(0.f), pixelLimit)) >> kTileSizeLog2;
+
+    // Finest level where the bounds fit in a 2x2 texel footprint
+    int level = 0;
+    while (level + 1 < int(mLevels.size()) && (tileMax.x - tileMin.x > 1 || tileMax.y - tileMin.y > 1)) {
+        tileMin >>= 1;
+        tileMax >>= 1;
+        level++;
+    }
+
+    float2 t0 = texel(level, tileMin.x, tileMin.y), t1 = texel(level, tileMax.x, tileMin.y);
+    float2 t2 = texel(level, tileMin.x, tileMax.y), t3 = texel(level, tileMax.x, tileMax.y);
+    // RHS + ZO depth, the smaller the closer
+    if (std::max({t0.y, t1.y, t2.y, t3.y}) < vpBounds.minPoint.z) return HiZResult::Occluded;
+    if (vpBounds.maxPoint.z < std::min({t0.x, t1.x, t2.x, t3.x})) return HiZResult::Accepted;
+    return HiZResult::Visible;
+}
+}  // namespace Rastery
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Core/AABB.h"
+#include "Core/API/Texture.h"
+#include "Core/Math.h"
+
+namespace Rastery {
+enum class HiZResult {
+    Occluded,  ///< Behind the farthest depth of the footprint, can be skipped
+    Visible,   ///< Needs per sample depth test
+    Accepted,  ///< In front of the nearest depth of the footprint, every sample passes the depth test
+};
+
+/** Min/max hierarchical depth pyramid over a depth texture, all levels live in one contiguous array.
+ * Texels of level 0 cover kTileSize x kTileSize pixels, each upper level halves the resolution down to 1x1.
+ * Writes to the depth texture are recorded with markDirty() and only propagated into the pyramid by update(),
+ * so updates can be batched over many primitives. The pyramid persists across draws until invalidated.
+ */
+class HiZBuffer {
+   public:
+    static constexpr int kTileSizeLog2 = 3;
+    static constexpr int kTileSize = 1 << kTileSizeLog2;  ///< Pixels covered by a level 0 texel along each axis
+
+    /** Fit the pyramid to the depth texture size, a size change invalidates it.
+     */
+    void resize(int width, int height);
+
+    /** Drop the pyramid content, the next rebuild() rereads the whole depth texture.
+     */
+    void invalidate() { mValid = false; }
+
+    [[nodiscard]] bool isValid() const { return mValid; }
+
+    /** Reduce the whole depth texture into the pyramid.
+     */
+    void rebuild(CpuTexture& depthTexture);
+
+    /** Record that depth texels in the inclusive pixel range may have changed.
+     */
+    void markDirty(std::pair<uint2, uint2> pixelRange);
+
+    /** Number of markDirty() calls since the last update.
+     */
+    [[nodiscard]] uint32_t pendingUpdateCount() const { return mPendingUpdateCount; }
+
+    /** Propagate the dirty tiles from the depth texture up the pyramid.
+     */
+    void update(CpuTexture& depthTexture);
+
+    /** Test a viewport space box against a 2x2 texel footprint of the finest level that covers it.
+     */
+    [[nodiscard]] HiZResult test(const AABB& vpBounds) const;
+
+   private:
+    struct Level {
+        int width;
+        int height;
+        size_t offset;  ///< First texel of the level in mTexels
+    };
+
+    [[nodiscard]] float2& texel(int level, int x, int y) { return mTexels[mLevels[level].offset + size_t(y) * mLevels[level].width + x]; }
+    [[nodiscard]] const float2& texel(int level, int x, int y) const {
+        return mTexels[mLevels[level].offset + size_t(y) * mLevels[level].width + x];
+    }
+
+    int mWidth = 0;
+    int mHeight = 0;
+    std::vector<Level> mLevels;
+    std::vector<float2> mTexels;        ///< x = nearest, y = farthest depth of the texel footprint
+    std::vector<uint8_t> mDirtyTiles;   ///< Level 0 texels whose pixels changed since the last update
+    int2 mDirtyMin = int2(0);           ///< Inclusive level 0 bounds of the dirty tiles
+    int2 mDirtyMax = int2(-1);
+    uint32_t mPendingUpdateCount = 0;
+    bool mValid = false;
+};
+}  // namespace Rastery
@@ -0,0 +1,49 @@
+#pragma once
+#include <tbb/enumerable_thread_specific.h>
+
+#include <cstdint>
+
+namespace Rastery {
+/** Pipeline counters of a single worker thread.
+ * Padded to a cache line so that workers bumping their own counters never share one.
+ */
+struct alignas(64) PipelineCounters {
+    uint64_t drawnPrimitiveCount = 0;  ///< Primitives handed to a rasterizer
+    uint64_t fragmentsTested = 0;      ///< Covered samples that reached the depth test
+    uint64_t fragmentsPassed = 0;      ///< Samples that passed the depth test
+    uint64_t fragmentsShaded = 0;      ///< Fragment shader invocations
+
+    PipelineCounters& operator+=(const PipelineCounters& other) {
+        drawnPrimitiveCount += other.drawnPrimitiveCount;
+        fragmentsTested += other.fragmentsTested;
+        fragmentsPassed += other.fragmentsPassed;
+        fragmentsShaded += other.fragmentsShaded;
+        return *this;
+    }
+};
+
+/** Per-thread pipeline counters, reduced once per frame instead of contending on shared atomics.
+ * Fetch local() once per task and keep the reference, the lookup is too slow for per pixel use.
+ */
+class PipelineStatistics {
+   public:
+    [[nodiscard]] PipelineCounters& local() { return mCounters.local(); }
+
+    /** Zero the counters of every thread, the thread slots are kept for the next frame.
+     */
+    void reset() {
+        for (auto& counters : mCounters) counters = PipelineCounters{};
+    }
+
+    /** Sum of the counters of every thread, must not race with workers.
+     */
+    [[nodiscard]] PipelineCounters reduce() const {
+        PipelineCounters total;
+        for (const auto& counters : mCounters) total += counters;
+        return total;
+    }
+
+   private:
+    tbb::enumerable_thread_specific<PipelineCounters> mCounters;
+};
+}  // namespace Rastery
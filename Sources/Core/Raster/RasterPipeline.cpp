@@ -1,19 +1,24 @@
 #include "RasterPipeline.h"
 
 #include <Utils/Algorithms.h>
+#include <tbb/blocked_range.h>
 #include <tbb/blocked_range2d.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <cmath>
+#include <cstring>
 #include <glm/gtc/quaternion.hpp>
+#include <limits>
 #include <map>
 #include <memory>
 #include <queue>
 #include <sstream>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -22,6 +27,7 @@
 #include "Core/API/Vao.h"
 #include "Core/Color.h"
 #include "Core/Error.h"
+#include "Core/Simd.h"
 #include "Utils/Gui.h"
 #include "Utils/Logger.h"
 #include "Utils/Timer.h"
@@ -40,7 +46,7 @@ VertexOut operator+(const VertexOut& lhs, const VertexOut& rhs) {
 
 VertexOut operator-(const VertexOut& lhs, const VertexOut& rhs) {
     VertexOut result;
-    result.rasterPosition = lhs.rasterPosition + rhs.rasterPosition;
+    result.rasterPosition = lhs.rasterPosition - rhs.rasterPosition;
     result.position = lhs.position - rhs.position;
     result.normal = lhs.normal - rhs.normal;
     result.texCoord = lhs.texCoord - rhs.texCoord;
@@ -67,30 +73,128 @@ void RasterPipeline::beginFrame() {
     mStats.commitedPrimitiveCount = 0;
     mStats.drawCallCount = 0;
     mStats.accelerationTime = 0.f;
+    mStats.vertexShaderTime = 0.f;
+    mStats.primitiveSortTime = 0.f;
     mStats.primitiveRasterizeTime = 0.f;
     mStats.fullRasterizeTime = 0.f;
+    mStats.triangleSetupTime = 0.f;
     mStats.actualDrawCount = 0u;
+    mStats.fragmentsTested = 0u;
+    mStats.fragmentsPassed = 0u;
+    mStats.fragmentsShaded = 0u;
+    mStats.primitiveSizeHistogram.fill(0u);
+    mStatistics.reset();
+
+    mFrameArena.reset();
+
+    // The depth target is cleared between frames, the pyramid is rebuilt by the first draw using it
+    mHiZBuffer.invalidate();
+
+    // Every pixel starts the frame with equal samples taken from the cleared targets
+    for (auto& tile : mMultisampleTiles) {
+        tile.pixelSlots.clear();
+        tile.sampleDepth.clear();
+        tile.sampleColor.clear();
+    }
+
+    std::lock_guard lock(mDebugMutex);
+    mDebugDataValid = false;
+}
+
+void RasterPipeline::endFrame() {
+    PipelineCounters counters = mStatistics.reduce();
+    mStats.actualDrawCount = counters.drawnPrimitiveCount;
+    mStats.fragmentsTested = counters.fragmentsTested;
+    mStats.fragmentsPassed = counters.fragmentsPassed;
+    mStats.fragmentsShaded = counters.fragmentsShaded;
+}
+
+bool RasterPipeline::getDebugData(RasterizerDebugData& debugData) const {
+    std::lock_guard lock(mDebugMutex);
+    if (mDebugDataValid) debugData = mDebugData;
+    return mDebugDataValid;
 }
 
 void RasterPipeline::draw(const CpuVao& vao, BVH& bvh, VertexShader vertexShader, FragmentShader fragmentShader) {
-    auto primitives = executeVertexShader(vao, vertexShader);
+    draw<VertexShader, FragmentShader>(vao, bvh, vertexShader, fragmentShader);
+}
 
-    std::sort(primitives.begin(), primitives.end(), [](const TrianglePrimitive& p0, const TrianglePrimitive& p1) {
-        return std::min({p0.v0.rasterPosition.z, p0.v1.rasterPosition.z, p0.v2.rasterPosition.z}) <
-               std::min({p1.v0.rasterPosition.z, p1.v1.rasterPosition.z, p1.v2.rasterPosition.z});
-    });
+void RasterPipeline::drawBatched(const CpuVao& vao, BVH& bvh, const VertexShaderBatch& vertexShader,
+                                 const FragmentShaderBatch& fragmentShader) {
+    Timer stageTimer;
+    auto& primitives = executeVertexShader(vao, vertexShader);
+    stageTimer.end();
+    mStats.vertexShaderTime += stageTimer.elapsedMilliseconds();
+
+    stageTimer.begin();
+    sortPrimitives(primitives);
+    stageTimer.end();
+    mStats.primitiveSortTime += stageTimer.elapsedMilliseconds();
 
     executeRasterization(primitives, bvh, fragmentShader);
 }
 
-bool RasterPipeline::useHiZ() const { return mDesc.useHierarchicalZBuffer && mDesc.rasterMode != RasterMode::ScanLineZBuffer; }
+void RasterPipeline::sortPrimitives(std::vector<TrianglePrimitive>& primitives) {
+    // Key is the nearest vertex depth in the high and the primitive index in the low 32 bits
+    mPrimitiveSortKeys.resize(primitives.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, primitives.size()), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t i = range.begin(); i != range.end(); i++) {
+            const auto& p = primitives[i];
+            float minDepth = std::min({p.v0().rasterPosition.z, p.v1().rasterPosition.z, p.v2().rasterPosition.z});
+            mPrimitiveSortKeys[i] = (uint64_t(floatToOrderedUint(minDepth)) << 32) | uint64_t(i);
+        }
+    });
+    parallelRadixSortByHighBits(mPrimitiveSortKeys, mPrimitiveSortScratch);
+
+    // Primitives are moved once, gathered in key order
+    mSortedPrimitives.resize(primitives.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, primitives.size()), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t i = range.begin(); i != range.end(); i++) {
+            mSortedPrimitives[i] = primitives[uint32_t(mPrimitiveSortKeys[i])];
+        }
+    });
+    primitives.swap(mSortedPrimitives);
+}
+
+bool RasterPipeline::useHiZ() const {
+    return mDesc.useHierarchicalZBuffer && mDesc.rasterMode != RasterMode::ScanLineZBuffer &&
+           mDesc.rasterMode != RasterMode::TiledBinning && mDesc.rasterMode != RasterMode::IntervalScanLine &&
+           mDesc.rasterMode != RasterMode::VisibilityBuffer && mDesc.rasterMode != RasterMode::PrimitiveParallel &&
+           mDesc.sampleCount == SampleCount::x1 &&
+           mDesc.conservativeMode == ConservativeMode::None;
+}
 
 bool RasterPipeline::useAccelerationStructure() const { return mDesc.useAccelerationStructure; }
 
+bool RasterPipeline::supportsConservativeRaster() const {
+    return mDesc.sampleCount == SampleCount::x1 &&
+           (mDesc.rasterMode == RasterMode::TiledBinning || mDesc.rasterMode == RasterMode::VisibilityBuffer ||
+            mDesc.rasterMode == RasterMode::PrimitiveParallel);
+}
+
 void RasterPipeline::renderUI() {
     dropdown("Cull Mode", mDesc.cullMode);
 
+    // Multisampled draws always rasterize in tiles, the raster mode only applies to single sampled draws
+    bool isMultisampled = mDesc.sampleCount != SampleCount::x1;
+    ImGui::BeginDisabled(isMultisampled);
     dropdown("Raster Mode", mDesc.rasterMode);
+    ImGui::EndDisabled();
+
+    dropdown("MSAA", mDesc.sampleCount);
+    if (isMultisampled) {
+        ImGui::TextDisabled("Rasterized by tiled MSAA, raster mode is ignored");
+    }
+
+    // Unsupported combinations are not selectable, switching to such a raster mode turns conservative coverage off
+    if (!supportsConservativeRaster()) mDesc.conservativeMode = ConservativeMode::None;
+    ImGui::BeginDisabled(!supportsConservativeRaster());
+    dropdown("Conservative Raster", mDesc.conservativeMode);
+    ImGui::EndDisabled();
+
+    if (mDesc.rasterMode == RasterMode::IntervalScanLine) {
+        ImGui::Checkbox("Write interval depth", &mDesc.writeIntervalDepth);
+    }
 
     ImGui::Checkbox("Enable Hi-Z", &mDesc.useHierarchicalZBuffer);
     if (useHiZ()) {
@@ -103,10 +207,23 @@ void RasterPipeline::renderStats() const {
     std::stringstream ss;
 
     ss << "Statistics:\n"
+       << fmt::format("Vertex shader time: {:.2f}ms\n", mStats.vertexShaderTime)
+       << fmt::format("Primitive sort time: {:.2f}ms\n", mStats.primitiveSortTime)
        << fmt::format("Overall raster time: {:.2f}ms\n", mStats.fullRasterizeTime)
-       << fmt::format("Primitive raster time: {:.2f}ms\n", mStats.primitiveRasterizeTime.load())
-       << fmt::format("Acceleration related time: {:.2f}ms\n", mStats.accelerationTime) << "Draw call count: " << mStats.drawCallCount
-       << "\nCommited primitive count: " << mStats.commitedPrimitiveCount << "\nActually draw count: " << mStats.actualDrawCount.load();
+       << fmt::format("Triangle setup time: {:.2f}ms\n", mStats.triangleSetupTime)
+       << fmt::format("Primitive raster time (with culling tests): {:.2f}ms\n", mStats.primitiveRasterizeTime)
+       << fmt::format("BVH/Hi-Z update time: {:.2f}ms\n", mStats.accelerationTime) << "Draw call count: " << mStats.drawCallCount
+       << "\nCommited primitive count: " << mStats.commitedPrimitiveCount << "\nActually draw count: " << mStats.actualDrawCount
+       << "\nFragments tested: " << mStats.fragmentsTested << "\nFragments passed: " << mStats.fragmentsPassed
+       << "\nFragments shaded: " << mStats.fragmentsShaded;
+
+    // Bucket i counts primitives with bounding box area in [4^i, 4^(i+1)) pixels
+    if (std::any_of(mStats.primitiveSizeHistogram.begin(), mStats.primitiveSizeHistogram.end(), [](uint32_t n) { return n > 0; })) {
+        ss << "\nPrimitive size histogram (bounding box px):";
+        for (int i = 0; i < Stats::kSizeBucketCount; i++) {
+            ss << fmt::format("\n  {}+: {}", 1 << (2 * i), mStats.primitiveSizeHistogram[i]);
+        }
+    }
 
     ImGui::Text("%s", ss.str().c_str());
 }
@@ -117,72 +234,231 @@ static bool isClockwise(const TrianglePrimitive& primitive) {
     // RHS
     // Check if the primitive is defined clockwise in homogeneous coordinates:
     // https://en.wikipedia.org/wiki/Back-face_culling
-    float3 v0v1 = clipToNDC(primitive.v1.rasterPosition) - clipToNDC(primitive.v0.rasterPosition);
-    float3 v0v2 = clipToNDC(primitive.v2.rasterPosition) - clipToNDC(primitive.v0.rasterPosition);
+    // det[x y w] has the sign of the NDC cross product when all w > 0, and stays valid for vertices behind the eye
+    float3 c0 = float3(primitive.v0().rasterPosition.x, primitive.v0().rasterPosition.y, primitive.v0().rasterPosition.w);
+    float3 c1 = float3(primitive.v1().rasterPosition.x, primitive.v1().rasterPosition.y, primitive.v1().rasterPosition.w);
+    float3 c2 = float3(primitive.v2().rasterPosition.x, primitive.v2().rasterPosition.y, primitive.v2().rasterPosition.w);
 
     // If the cross product points the opposite direction to forward, then front faced
-    return (v0v1.x * v0v2.y - v0v2.x * v0v1.y) > 0.f;
+    return dot(c0, cross(c1, c2)) > 0.f;
 }
 
-// TODO static std::vector<VertexOut> clipVerticesWithPlane(const std::vector<VertexOut>& inVertices, float3 normal, float3 p) {
-//     std::vector<VertexOut> result;
-//     // Iterate the polygon edges over the clip plane
-//     for (size_t i = 0; i <= inVertices.size(); i++) {
-//         int nextI = i % (inVertices.size());
+static constexpr int kClipPlaneCount = 6;        ///< near, far, left, right, bottom, top
+static constexpr float kGuardBandFactor = 8.f;  ///< Guard band size in multiples of the viewport
 
-//     }
-// }
+/** Signed distance of clip coordinate to the clip plane, positive inside.
+ * Side planes are scaled by extent, so extent = 1 gives the view frustum and extent > 1 the guard band.
+ */
+static float clipPlaneDistance(const float4& clipCoord, int plane, float extent) {
+    switch (plane) {
+        case 0:
+            return clipCoord.z;  // ZO depth
+        case 1:
+            return clipCoord.w - clipCoord.z;
+        case 2:
+            return clipCoord.x + extent * clipCoord.w;
+        case 3:
+            return extent * clipCoord.w - clipCoord.x;
+        case 4:
+            return clipCoord.y + extent * clipCoord.w;
+        default:
+            return extent * clipCoord.w - clipCoord.y;
+    }
+}
 
-/** Clip the primitive.
+/** Bit i is set if the clip coordinate is outside plane i.
  */
-static void clipPrimitive(TrianglePrimitive prim, tbb::concurrent_vector<TrianglePrimitive>& out) {
-    // Clip space coordinates
-    out.push_back(prim);
-    // std::vector<VertexOut> vertices{prim.v0, prim.v1, prim.v2};
-    // Intersect the triangle with clip cube
+static uint32_t computeOutcode(const float4& clipCoord, float extent) {
+    uint32_t outcode = 0u;
+    for (int plane = 0; plane < kClipPlaneCount; plane++) {
+        if (clipPlaneDistance(clipCoord, plane, extent) < 0.f) outcode |= 1u << plane;
+    }
+    return outcode;
 }
 
-tbb::concurrent_vector<TrianglePrimitive> RasterPipeline::executeVertexShader(const CpuVao& vao, VertexShader vertexShader) const {
-    const auto& indexData = vao.indexData;
-    const auto& vertexData = vao.vertexData;
+static constexpr int kMaxClipVertexCount = 3 + kClipPlaneCount;  ///< Sutherland-Hodgman adds at most one vertex per plane
 
-    tbb::concurrent_vector<VertexOut> vertexResult(indexData.empty() ? vertexData.size() : indexData.size());
+using ClipPolygon = std::array<VertexOut, kMaxClipVertexCount>;
 
-    if (indexData.empty()) {
-        tbb::parallel_for(0, (int)vertexData.size(), [&](int index) { vertexResult[index] = vertexShader(vertexData[index]); });
-    } else {
-        tbb::parallel_for(0, (int)indexData.size(), [&](int i) { vertexResult[i] = vertexShader(vertexData[indexData[i]]); });
+/** Clip the primitive in homogeneous space.
+ * Primitives outside the frustum are rejected, primitives inside the guard band are passed through and scissored
+ * by the rasterizer, the rest are clipped against near/far and guard band planes.
+ * @return 0 if rejected, 1 if passed through unchanged, otherwise the vertex count of the clipped polygon.
+ */
+static int clipPrimitive(const TrianglePrimitive& prim, ClipPolygon& polygon) {
+    // Clip space coordinates
+    const float4& c0 = prim.v0().rasterPosition;
+    const float4& c1 = prim.v1().rasterPosition;
+    const float4& c2 = prim.v2().rasterPosition;
+
+    // All vertices outside the same frustum plane, reject before homogeneous division
+    if (computeOutcode(c0, 1.f) & computeOutcode(c1, 1.f) & computeOutcode(c2, 1.f)) {
+        return 0;
     }
 
-    tbb::concurrent_vector<TrianglePrimitive> primitives;
-    primitives.reserve(vertexResult.size() / 3);
+    uint32_t crossedPlanes =
+        computeOutcode(c0, kGuardBandFactor) | computeOutcode(c1, kGuardBandFactor) | computeOutcode(c2, kGuardBandFactor);
+    if (crossedPlanes == 0u) {
+        return 1;
+    }
 
-    CullMode cullMode = mDesc.cullMode;
-    auto cullFunc = [cullMode](bool frontFace) {
-        return (cullMode == CullMode::None) || (cullMode == CullMode::FrontFace && !frontFace) ||
-               (cullMode == CullMode::BackFace && frontFace);
-    };
+    // Sutherland-Hodgman
+    ClipPolygon clipped;
+    polygon[0] = prim.v0();
+    polygon[1] = prim.v1();
+    polygon[2] = prim.v2();
+    auto* pPolygon = &polygon;
+    auto* pClipped = &clipped;
+    int count = 3;
+    for (int plane = 0; plane < kClipPlaneCount && count >= 3; plane++) {
+        if (!(crossedPlanes & (1u << plane))) continue;
+
+        int clippedCount = 0;
+        for (int i = 0; i < count; i++) {
+            const VertexOut& cur = (*pPolygon)[i];
+            const VertexOut& next = (*pPolygon)[(i + 1) % count];
+            float dCur = clipPlaneDistance(cur.rasterPosition, plane, kGuardBandFactor);
+            float dNext = clipPlaneDistance(next.rasterPosition, plane, kGuardBandFactor);
+            if (dCur >= 0.f) {
+                (*pClipped)[clippedCount++] = cur;
+            }
+            if ((dCur >= 0.f) != (dNext >= 0.f)) {
+                float t = dCur / (dCur - dNext);
+                (*pClipped)[clippedCount++] = cur * (1.f - t) + next * t;
+            }
+        }
+        std::swap(pPolygon, pClipped);
+        count = clippedCount;
+    }
+
+    if (count < 3) return 0;
+    if (pPolygon != &polygon) {
+        std::copy_n(pPolygon->begin(), count, polygon.begin());
+    }
+    return count;
+}
+
+template <CullMode kCullMode>
+static bool isCulled(const TrianglePrimitive& primitive) {
+    if constexpr (kCullMode == CullMode::BackFace) {
+        return !isClockwise(primitive);
+    } else if constexpr (kCullMode == CullMode::FrontFace) {
+        return isClockwise(primitive);
+    } else {
+        return false;
+    }
+}
 
-    tbb::parallel_for(0, (int)vertexResult.size() / 3, [&](int index) {
+static constexpr size_t kAssembleBlockSize = 4096;  ///< Primitives per block of the count and scatter passes, fixed for determinism
+
+/** Assemble, cull and clip primitives, fetchVertex(i) returns the post-transform vertex of the i-th index.
+ * Output is contiguous and in index buffer order regardless of thread count: blocks count their output triangles and
+ * clipped vertices first, a prefix sum over the blocks gives every block its output range, and the blocks scatter into it.
+ */
+template <CullMode kCullMode, typename FetchVertex>
+static void assemblePrimitives(size_t primitiveCount, const FetchVertex& fetchVertex, FrameArena& arena,
+                               std::vector<TrianglePrimitive>& primitives, std::vector<VertexOut>& clippedVertices,
+                               std::vector<uint8_t>& polygonSizes) {
+    auto assemble = [&](size_t index) {
         TrianglePrimitive primitive;
-        int vIndex = index * 3;
-        RASTERY_ASSERT(vIndex + 2 < int(vertexResult.size()));
-        primitive.v0 = vertexResult[vIndex + 0];
-        primitive.v1 = vertexResult[vIndex + 1];
-        primitive.v2 = vertexResult[vIndex + 2];
+        primitive.pV0 = fetchVertex(index * 3 + 0);
+        primitive.pV1 = fetchVertex(index * 3 + 1);
+        primitive.pV2 = fetchVertex(index * 3 + 2);
         primitive.id = uint32_t(index);
+        return primitive;
+    };
+    auto outputCount = [](int polygonSize) { return polygonSize == 1 ? 1 : std::max(polygonSize - 2, 0); };
+
+    // 1. Count pass, the polygon size of every primitive is kept so the scatter pass skips culled ones
+    size_t blockCount = (primitiveCount + kAssembleBlockSize - 1) / kAssembleBlockSize;
+    std::span<uint32_t> primitiveOffsets = arena.allocate<uint32_t>(blockCount + 1, 0u);
+    std::span<uint32_t> vertexOffsets = arena.allocate<uint32_t>(blockCount + 1, 0u);
+    polygonSizes.resize(primitiveCount);
+    tbb::parallel_for(size_t(0), blockCount, [&](size_t block) {
+        ClipPolygon polygon;
+        uint32_t blockPrimitiveCount = 0, blockVertexCount = 0;
+        for (size_t i = block * kAssembleBlockSize, end = std::min(primitiveCount, i + kAssembleBlockSize); i < end; i++) {
+            TrianglePrimitive primitive = assemble(i);
+            int polygonSize = isCulled<kCullMode>(primitive) ? 0 : clipPrimitive(primitive, polygon);
+            polygonSizes[i] = uint8_t(polygonSize);
+            blockPrimitiveCount += outputCount(polygonSize);
+            blockVertexCount += polygonSize >= 3 ? polygonSize : 0;
+        }
+        primitiveOffsets[block + 1] = blockPrimitiveCount;
+        vertexOffsets[block + 1] = blockVertexCount;
+    });
 
-        if (!cullFunc(isClockwise(primitive))) {
-            return;
+    // 2. Prefix sum over blocks
+    for (size_t block = 0; block < blockCount; block++) {
+        primitiveOffsets[block + 1] += primitiveOffsets[block];
+        vertexOffsets[block + 1] += vertexOffsets[block];
+    }
+    primitives.resize(primitiveOffsets.back());
+    clippedVertices.resize(vertexOffsets.back());
+
+    // 3. Scatter pass, clipping is redone for the few primitives that need it instead of being buffered
+    tbb::parallel_for(size_t(0), blockCount, [&](size_t block) {
+        ClipPolygon polygon;
+        uint32_t primitiveOffset = primitiveOffsets[block], vertexOffset = vertexOffsets[block];
+        for (size_t i = block * kAssembleBlockSize, end = std::min(primitiveCount, i + kAssembleBlockSize); i < end; i++) {
+            if (polygonSizes[i] == 0) continue;
+
+            TrianglePrimitive primitive = assemble(i);
+            if (polygonSizes[i] == 1) {
+                primitives[primitiveOffset++] = primitive;
+                continue;
+            }
+
+            // Triangle fan keeps the winding, clipped vertices are never moved after the resize above
+            int count = clipPrimitive(primitive, polygon);
+            RASTERY_ASSERT(count == polygonSizes[i]);
+            VertexOut* pPolygon = &clippedVertices[vertexOffset];
+            std::copy_n(polygon.begin(), count, pPolygon);
+            vertexOffset += count;
+            for (int v = 1; v + 1 < count; v++) {
+                TrianglePrimitive clippedPrim;
+                clippedPrim.id = primitive.id;
+                clippedPrim.pV0 = &pPolygon[0];
+                clippedPrim.pV1 = &pPolygon[v];
+                clippedPrim.pV2 = &pPolygon[v + 1];
+                primitives[primitiveOffset++] = clippedPrim;
+            }
         }
+    });
+}
 
-        // Clip primitive
-        clipPrimitive(primitive, primitives);
+std::vector<TrianglePrimitive>& RasterPipeline::executeVertexShader(const CpuVao& vao, const VertexShaderBatch& vertexShader) {
+    const auto& indexData = vao.indexData;
+    const auto& vertexData = vao.vertexData;
+
+    // Post-transform vertex cache, every unique vertex is shaded exactly once and shared by all primitives referencing it
+    mTransformedVertices.resize(vertexData.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, vertexData.size()), [&](const tbb::blocked_range<size_t>& range) {
+        vertexShader(std::span(vertexData).subspan(range.begin(), range.size()),
+                     std::span(mTransformedVertices).subspan(range.begin(), range.size()));
     });
 
-    primitives.shrink_to_fit();
+    size_t vertexCount = indexData.empty() ? vertexData.size() : indexData.size();
+    auto fetchVertex = [&](size_t i) -> const VertexOut* {
+        uint32_t vertexIndex = indexData.empty() ? uint32_t(i) : indexData[i];
+        RASTERY_ASSERT(vertexIndex < mTransformedVertices.size());
+        return &mTransformedVertices[vertexIndex];
+    };
+
+    size_t primitiveCount = vertexCount / 3;
+    switch (mDesc.cullMode) {
+        case CullMode::BackFace:
+            assemblePrimitives<CullMode::BackFace>(primitiveCount, fetchVertex, mFrameArena, mPrimitives, mClippedVertices, mPolygonSizes);
+            break;
+        case CullMode::FrontFace:
+            assemblePrimitives<CullMode::FrontFace>(primitiveCount, fetchVertex, mFrameArena, mPrimitives, mClippedVertices, mPolygonSizes);
+            break;
+        case CullMode::None:
+            assemblePrimitives<CullMode::None>(primitiveCount, fetchVertex, mFrameArena, mPrimitives, mClippedVertices, mPolygonSizes);
+            break;
+    }
 
-    return primitives;
+    return mPrimitives;
 }
 
 /** Convert from NDC((-1, -1, 0) - (1, 1, 1))
@@ -195,18 +471,19 @@ static float3 ndcToViewport(int width, int height, float3 ndcCoord) {
     return float3(pixel, ndcCoord.z);
 }
 
-static float3 computeBarycentricCoordinate(float2 v0, float2 v1, float2 v2, float2 p) {
-    float2 v0v1 = v1 - v0;
-    float2 v0v2 = v2 - v0;
-    float2 v0p = p - v0;
-
-    float det_v1v2 = v0v1.x * v0v2.y - v0v1.y * v0v2.x;
-    float det_pv2 = v0p.x * v0v2.y - v0p.y * v0v2.x;
-    float det_v1p = v0v1.x * v0p.y - v0v1.y * v0p.x;
+/** True if the viewport space box misses the framebuffer or the [0, 1] depth range.
+ */
+static bool isOutsideViewport(const AABB& vpBounds, int width, int height) {
+    return vpBounds.maxPoint.x < 0.f || vpBounds.maxPoint.y < 0.f || vpBounds.minPoint.x >= float(width) ||
+           vpBounds.minPoint.y >= float(height) || vpBounds.maxPoint.z <= 0.f || vpBounds.minPoint.z > 1.f;
+}
 
-    float a = det_pv2 / det_v1v2;
-    float b = det_v1p / det_v1v2;
-    return float3(1 - a - b, a, b);
+/** Inclusive pixel range whose centers a viewport space box can cover, clamped to the framebuffer.
+ */
+static std::pair<int2, int2> computePixelRange(const AABB& vpBounds, int width, int height) {
+    int2 pixelLimit(width - 1, height - 1);
+    return {glm::clamp(int2(glm::floor(float2(vpBounds.minPoint))), int2(0), pixelLimit),
+            glm::clamp(int2(glm::floor(float2(vpBounds.maxPoint))), int2(0), pixelLimit)};
 }
 
 static bool isInsidePrimitive(float3 baryCoord) { return baryCoord.x >= 0 && baryCoord.y >= 0 && baryCoord.z >= 0 && baryCoord.z <= 1; }
@@ -222,69 +499,100 @@ static std::pair<uint2, uint2> computeScreenSpaceBound(std::span<const float3> p
     return {(uint2)rangeMin, (uint2)rangeMax};
 }
 
-bool RasterPipeline::earlyHiZBufferTest(const AABB& vpBounds) const {
-    RASTERY_ASSERT(!mHiZDepthTextures.empty());
-    // paramid top-down z test
-    uint2 minP = uint2(glm::clamp(glm::floor(float2(vpBounds.minPoint)), float2(0.0), float2(mDesc.width, mDesc.height) - 1.f));
-    uint2 maxP = uint2(glm::clamp(glm::floor(float2(vpBounds.maxPoint)), float2(0.0), float2(mDesc.width, mDesc.height) - 1.f));
-    int i = mHiZDepthTextures.size() - 1;
-    for (auto it = mHiZDepthTextures.rbegin(); it != mHiZDepthTextures.rend(); it++, i--) {
-        float fragFurthest = 0.0;
-        const auto& pTex = *it;
-        uint2 layerMinP = minP >> uint2(i);
-        uint2 layerMaxP = glm::max(maxP >> uint2(i), uint2(1));
-        for (uint32_t y = layerMinP.y; y <= layerMaxP.y; y++) {
-            for (uint32_t x = layerMinP.x; x <= layerMaxP.x; x++) {
-                fragFurthest = std::max(fragFurthest, (float)pTex->fetchClamped<float>(uint2(x, y)));
-            }
-        }
-        if (fragFurthest < vpBounds.minPoint.z) {
-            return false;
-        }
+static constexpr uint32_t kHiZUpdateBatchSize = 32;  ///< Primitives written before the Hi-Z pyramid is brought up to date
+
+void RasterPipeline::prepareHiZBuffer() {
+    const auto& desc = mpDepthTexture->getDesc();
+    mHiZBuffer.resize(desc.width, desc.height);
+    // Kept up to date by the previous draws of the frame, only rebuilt after the depth target was written without it
+    if (mHiZBuffer.isValid()) {
+        updateHiZBuffer(true);
+    } else {
+        mHiZBuffer.rebuild(*mpDepthTexture);
     }
-    return true;
 }
 
-bool RasterPipeline::earlyHiZBufferTest(const AABB& vpBounds, int layer) const {
-    RASTERY_ASSERT(!mHiZDepthTextures.empty());
-    // paramid top-down z test
-    uint2 minP = uint2(glm::clamp(glm::floor(float2(vpBounds.minPoint)), float2(0.0), float2(mDesc.width, mDesc.height) - 1.f));
-    uint2 maxP = uint2(glm::clamp(glm::floor(float2(vpBounds.maxPoint)), float2(0.0), float2(mDesc.width, mDesc.height) - 1.f));
-    float fragFurthest = 0.0;
-    layer = std::clamp<int>(layer, 0, mHiZDepthTextures.size() - 1);
-    const auto& pTex = mHiZDepthTextures[layer];
-    uint2 layerMinP = minP >> uint2(layer);
-    uint2 layerMaxP = glm::max(maxP >> uint2(layer), uint2(1));
-    for (uint32_t y = layerMinP.y; y <= layerMaxP.y; y++) {
-        for (uint32_t x = layerMinP.x; x <= layerMaxP.x; x++) {
-            fragFurthest = std::max(fragFurthest, (float)pTex->fetchClamped<float>(uint2(x, y)));
-        }
+void RasterPipeline::updateHiZBuffer(bool force) {
+    if (mHiZBuffer.pendingUpdateCount() >= (force ? 1u : kHiZUpdateBatchSize)) {
+        mHiZBuffer.update(*mpDepthTexture);
     }
-    if (fragFurthest < vpBounds.minPoint.z) {
-        return false;
+}
+
+static constexpr size_t kOcclusionQueryGrainSize = 4;  ///< Visibility words, 64 boxes each, tested serially by one task
+
+/** Fill one visibility bit per query in parallel, tasks own whole words so no bit is shared between threads.
+ */
+template <typename IsVisible>
+static void evaluateVisibilityBits(size_t count, std::vector<uint64_t>& visibility, IsVisible&& isVisible) {
+    visibility.assign((count + 63) / 64, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, visibility.size(), kOcclusionQueryGrainSize),
+                      [&](const tbb::blocked_range<size_t>& words) {
+                          for (size_t word = words.begin(); word != words.end(); word++) {
+                              uint64_t bits = 0;
+                              for (size_t i = word * 64, end = std::min(count, word * 64 + 64); i < end; i++) {
+                                  if (isVisible(i)) bits |= uint64_t(1) << (i % 64);
+                              }
+                              visibility[word] = bits;
+                          }
+                      });
+}
+
+/** Viewport space bounds of a world space box, the 8 corners are transformed as 4-wide clip space vectors.
+ * @return false if a corner is not in front of the camera(w <= 0), the box cannot be bounded in viewport space then.
+ */
+static bool projectBox(const AABB& box, const std::array<SimdFloat4, 4>& columns, int width, int height, AABB& vpBounds) {
+    // A corner is the sum of one x, one y and one z term of the matrix columns
+    const SimdFloat4 xTerms[2] = {columns[0] * SimdFloat4(box.minPoint.x), columns[0] * SimdFloat4(box.maxPoint.x)};
+    const SimdFloat4 yTerms[2] = {columns[1] * SimdFloat4(box.minPoint.y), columns[1] * SimdFloat4(box.maxPoint.y)};
+    const SimdFloat4 zTerms[2] = {columns[2] * SimdFloat4(box.minPoint.z) + columns[3],
+                                  columns[2] * SimdFloat4(box.maxPoint.z) + columns[3]};
+
+    SimdFloat4 ndcMin(std::numeric_limits<float>::infinity()), ndcMax(-std::numeric_limits<float>::infinity());
+    for (int corner = 0; corner < 8; corner++) {
+        SimdFloat4 clip = xTerms[corner & 1] + yTerms[(corner >> 1) & 1] + zTerms[corner >> 2];
+        alignas(16) float clipLanes[4];
+        clip.store(clipLanes);
+        // Negated compare also catches NaN
+        if (!(clipLanes[3] > 0.f)) return false;
+        SimdFloat4 ndc = clip / SimdFloat4(clipLanes[3]);
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
     }
 
+    alignas(16) float lo[4], hi[4];
+    ndcMin.store(lo);
+    ndcMax.store(hi);
+    // Viewport y points down, the top edge comes from the largest NDC y
+    vpBounds.minPoint = ndcToViewport(width, height, float3(lo[0], hi[1], lo[2]));
+    vpBounds.maxPoint = ndcToViewport(width, height, float3(hi[0], lo[1], hi[2]));
     return true;
 }
 
-void RasterPipeline::cascadeUpdateHiZBuffer(std::pair<uint2, uint2> range) {
-    uint2 minP = range.first / 2u, maxP = range.second / 2u;
-    for (int i = 1; i < mHiZDepthTextures.size(); i++) {
-        auto pCurTex = mHiZDepthTextures[i];
-        auto pLastTex = mHiZDepthTextures[i - 1];
-        for (uint32_t y = minP.y; y <= maxP.y; y++) {
-            for (uint32_t x = minP.x; x <= maxP.x; x++) {
-                uint2 xyLast(x << 1, y << 1);
-                float z0 = pLastTex->fetchClamped<float>(xyLast);
-                float z1 = pLastTex->fetchClamped<float>(xyLast + uint2(0, 1));
-                float z2 = pLastTex->fetchClamped<float>(xyLast + uint2(1, 0));
-                float z3 = pLastTex->fetchClamped<float>(xyLast + uint2(1, 1));
-                pCurTex->fetch<float>(uint2(x, y)) = std::max({z0, z1, z2, z3});
-                minP >>= uint2(1);
-                maxP >>= uint2(1);
-            }
-        }
-    }
+void RasterPipeline::queryOcclusion(std::span<const AABB> boxes, const float4x4& viewProjection, std::vector<uint64_t>& visibility) {
+    RASTERY_ASSERT(mpDepthTexture);
+    prepareHiZBuffer();
+
+    std::array<SimdFloat4, 4> columns;
+    for (int i = 0; i < 4; i++) columns[i] = SimdFloat4::load(&viewProjection[i][0]);
+    int width = mDesc.width;
+    int height = mDesc.height;
+    evaluateVisibilityBits(boxes.size(), visibility, [&](size_t i) {
+        AABB vpBounds;
+        // Boxes reaching behind the camera are conservatively visible
+        if (!projectBox(boxes[i], columns, width, height, vpBounds)) return true;
+        return !isOutsideViewport(vpBounds, width, height) && mHiZBuffer.test(vpBounds) != HiZResult::Occluded;
+    });
+}
+
+void RasterPipeline::queryOcclusion(std::span<const AABB> viewportBoxes, std::vector<uint64_t>& visibility) {
+    RASTERY_ASSERT(mpDepthTexture);
+    prepareHiZBuffer();
+
+    int width = mDesc.width;
+    int height = mDesc.height;
+    evaluateVisibilityBits(viewportBoxes.size(), visibility, [&](size_t i) {
+        return !isOutsideViewport(viewportBoxes[i], width, height) && mHiZBuffer.test(viewportBoxes[i]) != HiZResult::Occluded;
+    });
 }
 
 bool RasterPipeline::zBufferTest(float2 sample, float depth) {
@@ -299,182 +607,507 @@ bool RasterPipeline::zBufferTest(float2 sample, float depth) {
     return passed;
 }
 
-void RasterPipeline::rasterizePrimitive(const TrianglePrimitive& primitive, FragmentShader fragmentShader) {
+/** Triangle setup, computes barycentric/depth gradients and attribute planes of the primitive once.
+ * @return false if the primitive is degenerate in viewport space.
+ */
+static bool setupTriangle(const TrianglePrimitive& primitive, int width, int height, TriangleSetup& setup,
+                          TriangleAttributeSetup& attributes) {
+    const VertexOut& v0 = primitive.v0();
+    const VertexOut& v1 = primitive.v1();
+    const VertexOut& v2 = primitive.v2();
+    setup.vpCrd[0] = ndcToViewport(width, height, clipToNDC(v0.rasterPosition));
+    setup.vpCrd[1] = ndcToViewport(width, height, clipToNDC(v1.rasterPosition));
+    setup.vpCrd[2] = ndcToViewport(width, height, clipToNDC(v2.rasterPosition));
+    attributes.primitiveId = primitive.id;
+
+    float2 v0v1 = float2(setup.vpCrd[1]) - float2(setup.vpCrd[0]);
+    float2 v0v2 = float2(setup.vpCrd[2]) - float2(setup.vpCrd[0]);
+    float det = v0v1.x * v0v2.y - v0v1.y * v0v2.x;
+    setup.valid = det != 0.f && std::isfinite(det);
+    if (!setup.valid) {
+        return false;
+    }
+
+    float invDet = 1.f / det;
+    setup.gradB1 = float2(v0v2.y, -v0v2.x) * invDet;
+    setup.gradB2 = float2(-v0v1.y, v0v1.x) * invDet;
+    setup.gradDepth = setup.gradB1 * (setup.vpCrd[1].z - setup.vpCrd[0].z) + setup.gradB2 * (setup.vpCrd[2].z - setup.vpCrd[0].z);
+
+    // a(p) = a0 + b1(p) * (a1 - a0) + b2(p) * (a2 - a0), the gradient of a follows from the weight gradients
+    auto setupPlane = [&](const auto& a0, const auto& a1, const auto& a2, auto& base, auto& ddx, auto& ddy) {
+        auto d1 = a1 - a0;
+        auto d2 = a2 - a0;
+        base = a0;
+        ddx = d1 * setup.gradB1.x + d2 * setup.gradB2.x;
+        ddy = d1 * setup.gradB1.y + d2 * setup.gradB2.y;
+    };
+    VertexOut& base = attributes.base;
+    VertexOut& ddx = attributes.ddx;
+    VertexOut& ddy = attributes.ddy;
+    // Raster position planes are kept in the FragIn layout, NDC xy and depth with the clip space w
+    auto rasterPosition = [&](const VertexOut& v, int i) {
+        return float4(float2(clipToNDC(v.rasterPosition)), setup.vpCrd[i].z, v.rasterPosition.w);
+    };
+    setupPlane(rasterPosition(v0, 0), rasterPosition(v1, 1), rasterPosition(v2, 2), base.rasterPosition, ddx.rasterPosition,
+               ddy.rasterPosition);
+    setupPlane(v0.position, v1.position, v2.position, base.position, ddx.position, ddy.position);
+    setupPlane(v0.normal, v1.normal, v2.normal, base.normal, ddx.normal, ddy.normal);
+    setupPlane(v0.texCoord, v1.texCoord, v2.texCoord, base.texCoord, ddx.texCoord, ddy.texCoord);
+    return true;
+}
+
+static float3 evaluateBarycentric(const TriangleSetup& setup, float2 samplePoint) {
+    float2 p = samplePoint - float2(setup.vpCrd[0]);
+    float b1 = dot(setup.gradB1, p);
+    float b2 = dot(setup.gradB2, p);
+    return float3(1.f - b1 - b2, b1, b2);
+}
+
+/** NDC depth at the sample point, a single plane evaluation.
+ */
+static float evaluateDepth(const TriangleSetup& setup, float2 samplePoint) {
+    return setup.vpCrd[0].z + dot(setup.gradDepth, samplePoint - float2(setup.vpCrd[0]));
+}
+
+/** Barycentric bias that moves the coverage test of every edge from the pixel center to the pixel corner
+ * farthest inside (over-estimation) or farthest outside (under-estimation) of that edge.
+ */
+static float3 conservativeCoverageBias(const TriangleSetup& setup, ConservativeMode mode) {
+    if (mode == ConservativeMode::None) return float3(0.f);
+    float2 gradB0 = -(setup.gradB1 + setup.gradB2);
+    float3 extent = 0.5f * float3(std::abs(gradB0.x) + std::abs(gradB0.y), std::abs(setup.gradB1.x) + std::abs(setup.gradB1.y),
+                                  std::abs(setup.gradB2.x) + std::abs(setup.gradB2.y));
+    return mode == ConservativeMode::OverEstimate ? extent : -extent;
+}
+
+/** Pixel coverage with the conservative bias applied, equal to isInsidePrimitive at the pixel center when the bias is zero.
+ */
+static bool isPixelCovered(const TriangleSetup& setup, int2 pixel, float3 coverageBias) {
+    float3 baryCoord = evaluateBarycentric(setup, float2(pixel) + float2(0.5));
+    if (coverageBias == float3(0.f)) return isInsidePrimitive(baryCoord);
+    return all(glm::greaterThanEqual(baryCoord + coverageBias, float3(0.f)));
+}
+
+/** Depth of the pixel, conservative modes take the nearest or farthest depth of the primitive over the pixel area.
+ */
+static float evaluatePixelDepth(const TriangleSetup& setup, int2 pixel, ConservativeMode mode) {
+    float depth = evaluateDepth(setup, float2(pixel) + float2(0.5));
+    if (mode == ConservativeMode::None) return depth;
+
+    // The primitive never leaves the depth range of its vertices
+    float extent = 0.5f * (std::abs(setup.gradDepth.x) + std::abs(setup.gradDepth.y));
+    float minDepth = std::min({setup.vpCrd[0].z, setup.vpCrd[1].z, setup.vpCrd[2].z});
+    float maxDepth = std::max({setup.vpCrd[0].z, setup.vpCrd[1].z, setup.vpCrd[2].z});
+    if (mode == ConservativeMode::OverEstimate) return std::max(depth - extent, minDepth);
+    return std::min(depth + extent, maxDepth);
+}
+
+/** Interpolate fragment attributes at the sample point, raster position takes the tested depth.
+ */
+static FragIn interpolateAttributes(const TriangleSetup& setup, const TriangleAttributeSetup& attributes, float2 samplePoint,
+                                    float depth) {
+    float2 p = samplePoint - float2(setup.vpCrd[0]);
+    auto evaluate = [p](const auto& base, const auto& ddx, const auto& ddy) { return base + ddx * p.x + ddy * p.y; };
+    const VertexOut& base = attributes.base;
+    const VertexOut& ddx = attributes.ddx;
+    const VertexOut& ddy = attributes.ddy;
+
+    FragIn fragIn;
+    fragIn.rasterPosition = evaluate(base.rasterPosition, ddx.rasterPosition, ddy.rasterPosition);
+    fragIn.rasterPosition.z = depth;
+    fragIn.position = evaluate(base.position, ddx.position, ddy.position);
+    fragIn.normal = evaluate(base.normal, ddx.normal, ddy.normal);
+    fragIn.texCoord = evaluate(base.texCoord, ddx.texCoord, ddy.texCoord);
+    return fragIn;
+}
+
+/** Interpolate the fragment at the pixel, attributes are planar over the primitive so their screen space derivatives
+ * are the plane gradients of the attribute setup.
+ */
+static void prepareFragment(const TriangleSetup& setup, const TriangleAttributeSetup& attributes, int2 pixel, float depth,
+                            FragIn& fragIn, GraphicsContextData& context) {
+    fragIn = interpolateAttributes(setup, attributes, float2(pixel) + float2(0.5), depth);
+    context = GraphicsContextData(attributes, float2(pixel) + float2(0.5));
+}
+
+static constexpr int kFragmentBatchSize = 16;  ///< Fragments shaded by one batched fragment shader call
+
+/** Depth tested fragments waiting for shading, owned by a single worker.
+ * Colors are written in push order on flush, so a batch has to be flushed before any other worker may
+ * touch the same pixels.
+ */
+class FragmentBatch {
+   public:
+    FragmentBatch(const FragmentShaderBatch& fragmentShader, PipelineCounters& counters)
+        : mFragmentShader(fragmentShader), mCounters(counters) {}
+
+    FragmentBatch(const FragmentBatch&) = delete;
+    FragmentBatch& operator=(const FragmentBatch&) = delete;
+
+    ~FragmentBatch() { flush(); }
+
+    void push(const FragIn& fragIn, const GraphicsContextData& context, float4* pTarget) {
+        mFragIns[mCount] = fragIn;
+        mContexts[mCount] = context;
+        mTargets[mCount] = pTarget;
+        if (++mCount == kFragmentBatchSize) flush();
+    }
+
+    /** Counters of the thread that owns the batch.
+     */
+    [[nodiscard]] PipelineCounters& counters() { return mCounters; }
+
+    void flush() {
+        if (mCount == 0) return;
+        mCounters.fragmentsShaded += mCount;
+        mFragmentShader(std::span<const FragIn>(mFragIns.data(), mCount), std::span<const GraphicsContextData>(mContexts.data(), mCount),
+                        std::span<float4>(mColors.data(), mCount));
+        for (int i = 0; i < mCount; i++) {
+            *mTargets[i] = mColors[i];
+        }
+        mCount = 0;
+    }
+
+   private:
+    const FragmentShaderBatch& mFragmentShader;
+    PipelineCounters& mCounters;
+    int mCount = 0;
+    std::array<FragIn, kFragmentBatchSize> mFragIns;
+    std::array<GraphicsContextData, kFragmentBatchSize> mContexts;
+    std::array<float4, kFragmentBatchSize> mColors;
+    std::array<float4*, kFragmentBatchSize> mTargets;
+};
+
+static constexpr int kSubPixelBits = 8;  ///< Sub-pixel precision of the fixed-point rasterizer
+static constexpr int64_t kSubPixelScale = int64_t(1) << kSubPixelBits;
+static constexpr float kMaxFixedPointCoord = float(1 << 20);  ///< Keeps edge function products inside int64
+
+struct FixedPoint2 {
+    int64_t x;
+    int64_t y;
+};
+
+struct FixedPointEdge {
+    int64_t origin;  ///< Biased edge function value at the first sample of the bounding box
+    int64_t stepX;   ///< Increment per pixel in x
+    int64_t stepY;   ///< Increment per pixel in y
+    int64_t bias;    ///< Top-left fill rule bias, 0 for top/left edges, -1 otherwise
+
+    /** Evaluate at pixel offset (dx, dy) from the first sample.
+     */
+    [[nodiscard]] int64_t evaluate(int64_t dx, int64_t dy) const { return origin + stepX * dx + stepY * dy; }
+};
+
+static constexpr int kCoarseBlockSize = 16;  ///< First level block size of hierarchical traversal
+static constexpr int kFineBlockSize = 4;     ///< Second level block size of hierarchical traversal
+
+enum class BlockCoverage { Outside, Partial, Inside };
+
+/** Classify a pixel block given by offsets [min, max] from the first sample against the triangle edges.
+ * Edge functions are linear, so checking the extremes at the block corners is enough.
+ */
+static BlockCoverage classifyBlock(std::span<const FixedPointEdge, 3> edges, int2 blockMin, int2 blockMax) {
+    bool inside = true;
+    for (const auto& edge : edges) {
+        int64_t w = edge.evaluate(blockMin.x, blockMin.y);
+        int64_t spanX = edge.stepX * (blockMax.x - blockMin.x), spanY = edge.stepY * (blockMax.y - blockMin.y);
+        int64_t maxW = w + std::max<int64_t>(spanX, 0) + std::max<int64_t>(spanY, 0);
+        int64_t minW = w + std::min<int64_t>(spanX, 0) + std::min<int64_t>(spanY, 0);
+        if (maxW < 0) return BlockCoverage::Outside;
+        inside = inside && minW >= 0;
+    }
+    return inside ? BlockCoverage::Inside : BlockCoverage::Partial;
+}
+
+static FixedPoint2 snapToFixedPoint(float2 p) {
+    return {(int64_t)std::llround(p.x * float(kSubPixelScale)), (int64_t)std::llround(p.y * float(kSubPixelScale))};
+}
+
+/** Twice the signed area of (a, b, c), positive when c is on the interior side of a->b.
+ */
+static int64_t orient2d(const FixedPoint2& a, const FixedPoint2& b, const FixedPoint2& c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+static FixedPointEdge setupFixedPointEdge(const FixedPoint2& a, const FixedPoint2& b, const FixedPoint2& origin) {
+    int64_t dx = b.x - a.x, dy = b.y - a.y;
+    // y points down in viewport: a top edge is horizontal with interior below, a left edge goes upwards
+    bool isTopLeft = dy < 0 || (dy == 0 && dx > 0);
+
+    FixedPointEdge edge;
+    edge.bias = isTopLeft ? 0 : -1;
+    edge.origin = orient2d(a, b, origin) + edge.bias;
+    edge.stepX = -dy * kSubPixelScale;
+    edge.stepY = dx * kSubPixelScale;
+    return edge;
+}
+
+template <RasterMode kRasterMode, bool kUseHiZ>
+void RasterPipeline::rasterizePrimitive(const TriangleSetup& setup, const TriangleAttributeSetup& attributes,
+                                        const FragmentShaderBatch& fragmentShader) {
     int width = mDesc.width;
     int height = mDesc.height;
 
-    std::array<float3, 3> vpCrd;
-    vpCrd[0] = ndcToViewport(width, height, clipToNDC(primitive.v0.rasterPosition));
-    vpCrd[1] = ndcToViewport(width, height, clipToNDC(primitive.v1.rasterPosition));
-    vpCrd[2] = ndcToViewport(width, height, clipToNDC(primitive.v2.rasterPosition));
-    mStats.actualDrawCount++;
+    const auto& vpCrd = setup.vpCrd;
+    mStatistics.local().drawnPrimitiveCount++;
+    if (!setup.valid) return;
+
+    if constexpr (kRasterMode == RasterMode::Naive) {
+        tbb::parallel_for(tbb::blocked_range2d<int>(0, height, 0, width), [&](tbb::blocked_range2d<int> r) {
+            FragmentBatch batch(fragmentShader, mStatistics.local());
+            for (int y = r.rows().begin(), y_end = r.rows().end(); y < y_end; y++) {
+                for (int x = r.cols().begin(), x_end = r.cols().end(); x < x_end; x++) {
+                    rasterizePoint(int2(x, y), setup, attributes, batch);
+                }
+            }
+        });
+    } else if constexpr (kRasterMode == RasterMode::BoundedNaive) {
+        // Create a copy of vpCrd for sorting
+        std::array<float2, 3> v = {vpCrd[0], vpCrd[1], vpCrd[2]};
+        // bubble sort vertices by y
+        sort3(v[0], v[1], v[2], [](const float2& v1, const float2& v2) { return v1.y < v2.y; });
+
+        float triangleHeight = v[2].y - v[0].y;
+        float upperHeight = v[1].y - v[0].y;
+        float2 vMid = lerp(v[0], v[2], upperHeight / triangleHeight);
+        // Ensure vMid on the right side
+        if (vMid.x < v[1].x) std::swap(vMid, v[1]);
+
+        // The triangle should look like
+        //      + v0
+        //    +  +
+        // v1+    + vMid
+        //    +    +
+        //      +   +
+        //        +  +
+        //           +  v2
+
+        // Upper triangle
+        // 3.5 - 0.5 produce 3.0, compensate it
+        int yCnt = std::ceil(v[1].y) - std::floor(v[0].y);
+        tbb::parallel_for(0, yCnt, [&](int yOffset) {
+            FragmentBatch batch(fragmentShader, mStatistics.local());
+            float y = std::floor(v[0].y) + float(yOffset);
+            // (y - y2) / (y1 - y2) = (x - x2) / (x1 - x2)
+            auto xLeft = (int)std::floor(std::min((y - v[1].y) / (v[0].y - v[1].y) * (v[0].x - v[1].x) + v[1].x,
+                                                  (y + 1.f - v[1].y) / (v[0].y - v[1].y) * (v[0].x - v[1].x) + v[1].x));
+            auto xRight = (int)std::ceil(std::max((y - vMid.y) / (v[0].y - vMid.y) * (v[0].x - vMid.x) + vMid.x,
+                                                  (y + 1.f - vMid.y) / (v[0].y - vMid.y) * (v[0].x - vMid.x) + vMid.x));
+            rasterizeSpan(int(y), xLeft, xRight, setup, attributes, batch);
+        });
+
+        // Lower triangle
+        yCnt = std::ceil(v[2].y) - std::floor(v[1].y);
+        tbb::parallel_for(0, yCnt, [&](int yOffset) {
+            FragmentBatch batch(fragmentShader, mStatistics.local());
+            float y = std::floor(v[1].y) + float(yOffset);
+            auto xLeft = (int)std::floor(std::min((y - v[2].y) / (v[1].y - v[2].y) * (v[1].x - v[2].x) + v[2].x,
+                                                  (y + 1.f - v[2].y) / (v[1].y - v[2].y) * (v[1].x - v[2].x) + v[2].x));
+            auto xRight = (int)std::ceil(std::max((y - v[2].y) / (vMid.y - v[2].y) * (vMid.x - v[2].x) + v[2].x,
+                                                  (y + 1.f - v[2].y) / (vMid.y - v[2].y) * (vMid.x - v[2].x) + v[2].x));
+
+            rasterizeSpan(int(y), xLeft, xRight, setup, attributes, batch);
+        });
+    } else if constexpr (kRasterMode == RasterMode::HalfSpace) {
+        rasterizeHalfSpace(setup, attributes, fragmentShader);
+    } else {
+        static_assert(kRasterMode == RasterMode::HalfSpace, "Raster mode is not rasterized per primitive");
+    }
+
+    if constexpr (kUseHiZ) {
+        mHiZBuffer.markDirty(computeScreenSpaceBound(vpCrd, width, height));
+    }
+}
 
-    switch (mDesc.rasterMode) {
-        case RasterMode::Naive: {
-            tbb::parallel_for(tbb::blocked_range2d<int>(0, height, 0, width), [&](tbb::blocked_range2d<int> r) {
+void RasterPipeline::rasterizeHalfSpace(const TriangleSetup& setup, const TriangleAttributeSetup& attributes,
+                                        const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    const auto& viewportCrds = setup.vpCrd;
+    auto bounds = computeScreenSpaceBound(viewportCrds, width, height);
+    uint2 minP = bounds.first, maxP = bounds.second;
+
+    std::array<FixedPoint2, 3> v;
+    for (int i = 0; i < 3; i++) {
+        // Negated compare also catches NaN
+        if (!(std::abs(viewportCrds[i].x) < kMaxFixedPointCoord && std::abs(viewportCrds[i].y) < kMaxFixedPointCoord)) {
+            // Out of fixed-point range, fallback to float bounded rasterization
+            tbb::parallel_for(tbb::blocked_range2d<int>(minP.y, maxP.y + 1, minP.x, maxP.x + 1), [&](tbb::blocked_range2d<int> r) {
+                FragmentBatch batch(fragmentShader, mStatistics.local());
                 for (int y = r.rows().begin(), y_end = r.rows().end(); y < y_end; y++) {
                     for (int x = r.cols().begin(), x_end = r.cols().end(); x < x_end; x++) {
-                        rasterizePoint(int2(x, y), vpCrd, primitive, fragmentShader);
+                        rasterizePoint(int2(x, y), setup, attributes, batch);
                     }
                 }
             });
+            return;
+        }
+        v[i] = snapToFixedPoint(viewportCrds[i]);
+    }
 
-        } break;
-        case RasterMode::BoundedNaive: {
-            // Create a copy of vpCrd for sorting
-            std::array<float2, 3> v = {vpCrd[0], vpCrd[1], vpCrd[2]};
-            // bubble sort vertices by y
-            sort3(v[0], v[1], v[2], [](const float2& v1, const float2& v2) { return v1.y < v2.y; });
-
-            float triangleHeight = v[2].y - v[0].y;
-            float upperHeight = v[1].y - v[0].y;
-            float2 vMid = lerp(v[0], v[2], upperHeight / triangleHeight);
-            // Ensure vMid on the right side
-            if (vMid.x < v[1].x) std::swap(vMid, v[1]);
-
-            // The triangle should look like
-            //      + v0
-            //    +  +
-            // v1+    + vMid
-            //    +    +
-            //      +   +
-            //        +  +
-            //           +  v2
-
-            // Upper triangle
-            // 3.5 - 0.5 produce 3.0, compensate it
-            int yCnt = std::ceil(v[1].y) - std::floor(v[0].y);
-            tbb::parallel_for(0, yCnt, [&](int yOffset) {
-                float y = std::floor(v[0].y) + float(yOffset);
-                // (y - y2) / (y1 - y2) = (x - x2) / (x1 - x2)
-                auto xLeft = (int)std::floor(std::min((y - v[1].y) / (v[0].y - v[1].y) * (v[0].x - v[1].x) + v[1].x,
-                                                      (y + 1.f - v[1].y) / (v[0].y - v[1].y) * (v[0].x - v[1].x) + v[1].x));
-                auto xRight = (int)std::ceil(std::max((y - vMid.y) / (v[0].y - vMid.y) * (v[0].x - vMid.x) + vMid.x,
-                                                      (y + 1.f - vMid.y) / (v[0].y - vMid.y) * (v[0].x - vMid.x) + vMid.x));
-                for (int x = xLeft; x <= xRight; x++) {
-                    rasterizePoint(int2(x, y), vpCrd, primitive, fragmentShader);
-                }
-            });
+    int64_t area = orient2d(v[0], v[1], v[2]);
+    if (area == 0) return;
+
+    // Flip the winding so that the interior is always positive
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+    }
 
-            // Lower triangle
-            yCnt = std::ceil(v[2].y) - std::floor(v[1].y);
-            tbb::parallel_for(0, yCnt, [&](int yOffset) {
-                float y = std::floor(v[1].y) + float(yOffset);
-                auto xLeft = (int)std::floor(std::min((y - v[2].y) / (v[1].y - v[2].y) * (v[1].x - v[2].x) + v[2].x,
-                                                      (y + 1.f - v[2].y) / (v[1].y - v[2].y) * (v[1].x - v[2].x) + v[2].x));
-                auto xRight = (int)std::ceil(std::max((y - v[2].y) / (vMid.y - v[2].y) * (vMid.x - v[2].x) + v[2].x,
-                                                      (y + 1.f - v[2].y) / (vMid.y - v[2].y) * (vMid.x - v[2].x) + v[2].x));
-
-                for (int x = xLeft; x <= xRight; x++) {
-                    rasterizePoint(int2(x, y), vpCrd, primitive, fragmentShader);
+    // Edge i is opposite to vertex i, depth and attributes come from the triangle setup planes
+    FixedPoint2 origin{int64_t(minP.x) * kSubPixelScale + kSubPixelScale / 2, int64_t(minP.y) * kSubPixelScale + kSubPixelScale / 2};
+    std::array<FixedPointEdge, 3> edges = {setupFixedPointEdge(v[1], v[2], origin), setupFixedPointEdge(v[2], v[0], origin),
+                                           setupFixedPointEdge(v[0], v[1], origin)};
+
+    // Walk a block given by offsets from the first sample, coverage test can be skipped for blocks fully inside
+    int2 boundsOrigin = int2(minP);
+    auto rasterizeBlock = [&](FragmentBatch& batch, int2 blockMin, int2 blockMax, bool testCoverage) {
+        for (int dy = blockMin.y; dy <= blockMax.y; dy++) {
+            int64_t w0 = edges[0].evaluate(blockMin.x, dy);
+            int64_t w1 = edges[1].evaluate(blockMin.x, dy);
+            int64_t w2 = edges[2].evaluate(blockMin.x, dy);
+            for (int dx = blockMin.x; dx <= blockMax.x; dx++) {
+                if (!testCoverage || (w0 | w1 | w2) >= 0) {
+                    shadeFragment(boundsOrigin + int2(dx, dy), setup, attributes, batch);
                 }
-            });
+                w0 += edges[0].stepX;
+                w1 += edges[1].stepX;
+                w2 += edges[2].stepX;
+            }
+        }
+    };
 
-        } break;
-        default: {
-            RASTERY_UNREACHABLE();
-        };
-    }
+    // Hierarchical traversal: coarse blocks -> fine blocks -> pixels, trivially reject or accept whole blocks
+    int2 boundsSize = int2(maxP - minP) + 1;
+    int2 coarseCount = (boundsSize + kCoarseBlockSize - 1) / kCoarseBlockSize;
+    tbb::parallel_for(tbb::blocked_range2d<int>(0, coarseCount.y, 0, coarseCount.x), [&](tbb::blocked_range2d<int> r) {
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        for (int by = r.rows().begin(), by_end = r.rows().end(); by < by_end; by++) {
+            for (int bx = r.cols().begin(), bx_end = r.cols().end(); bx < bx_end; bx++) {
+                int2 coarseMin = int2(bx, by) * kCoarseBlockSize;
+                int2 coarseMax = glm::min(coarseMin + (kCoarseBlockSize - 1), boundsSize - 1);
+                BlockCoverage coverage = classifyBlock(edges, coarseMin, coarseMax);
+                if (coverage != BlockCoverage::Partial) {
+                    if (coverage == BlockCoverage::Inside) rasterizeBlock(batch, coarseMin, coarseMax, false);
+                    continue;
+                }
 
-    if (useHiZ()) {
-        int2 rangeMin(width, height), rangeMax(0, 0);
-        for (int i = 0; i < 3; i++) {
-            rangeMin = glm::min(rangeMin, (int2)glm::floor(vpCrd[i]));
-            rangeMax = glm::max(rangeMax, (int2)glm::ceil(vpCrd[i]));
+                for (int fy = coarseMin.y; fy <= coarseMax.y; fy += kFineBlockSize) {
+                    for (int fx = coarseMin.x; fx <= coarseMax.x; fx += kFineBlockSize) {
+                        int2 fineMin(fx, fy);
+                        int2 fineMax = glm::min(fineMin + (kFineBlockSize - 1), coarseMax);
+                        coverage = classifyBlock(edges, fineMin, fineMax);
+                        if (coverage != BlockCoverage::Outside) {
+                            rasterizeBlock(batch, fineMin, fineMax, coverage == BlockCoverage::Partial);
+                        }
+                    }
+                }
+            }
         }
-        rangeMin = glm::clamp(rangeMin, int2(0), int2(width - 1, height - 1));
-        rangeMax = glm::clamp(rangeMax, int2(0), int2(width - 1, height - 1));
-        cascadeUpdateHiZBuffer(computeScreenSpaceBound(vpCrd, width, height));
-    }
+        batch.flush();
+    });
 }
 
-void RasterPipeline::rasterizePoint(int2 pixel, std::span<const float3, 3> viewportCrds, const TrianglePrimitive& primitive,
-                                    FragmentShader fragmentShader, RasterizerDebugData* pDebugData) {
+void RasterPipeline::rasterizePoint(int2 pixel, const TriangleSetup& setup, const TriangleAttributeSetup& attributes, FragmentBatch& batch,
+                                    const RasterizerDebugData* pDebugData) {
     int width = mDesc.width;
     int height = mDesc.height;
 
     if (any(glm::lessThan(pixel, int2(0))) || any(glm::greaterThanEqual(pixel, int2(width, height)))) return;
-    Timer rasterTimer;
 
     float2 samplePoint = float2(pixel) + float2(0.5);
-    float3 baryCoord = computeBarycentricCoordinate(viewportCrds[0], viewportCrds[1], viewportCrds[2], samplePoint);
+    if (isInsidePrimitive(evaluateBarycentric(setup, samplePoint))) {
+        shadeFragment(pixel, setup, attributes, batch, pDebugData);
+    }
+}
 
-    if (!isInsidePrimitive(baryCoord)) {
-        rasterTimer.end();
-        mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+void RasterPipeline::shadeFragment(int2 pixel, const TriangleSetup& setup, const TriangleAttributeSetup& attributes, FragmentBatch& batch,
+                                   const RasterizerDebugData* pDebugData) {
+    float2 samplePoint = float2(pixel) + float2(0.5);
+    float depth = evaluateDepth(setup, samplePoint);
+    PipelineCounters& counters = batch.counters();
+    counters.fragmentsTested++;
+    if (depth <= 0 || depth > 1 || !zBufferTest(samplePoint, depth)) {
         return;
     }
+    counters.fragmentsPassed++;
 
-    // Interpolated fragment data in clip space
-    // FIXME interpolate in linear space
-    VertexOut interpolateVertex = primitive.v0 * baryCoord.x + primitive.v1 * baryCoord.y + primitive.v2 * baryCoord.z;
-    interpolateVertex.rasterPosition = float4(clipToNDC(interpolateVertex.rasterPosition), interpolateVertex.rasterPosition.w);
+    writeFragment(pixel, setup, attributes, depth, batch, pDebugData);
+}
 
-    if (interpolateVertex.rasterPosition.z <= 0 || interpolateVertex.rasterPosition.z > 1 ||
-        !zBufferTest(samplePoint, interpolateVertex.rasterPosition.z)) {
-        rasterTimer.end();
-        mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
-        return;
+void RasterPipeline::writeFragment(int2 pixel, const TriangleSetup& setup, const TriangleAttributeSetup& attributes, float depth,
+                                   FragmentBatch& batch, const RasterizerDebugData* pDebugData) {
+    // Prepare fragment and context data
+    FragIn fragIn;
+    GraphicsContextData context;
+    prepareFragment(setup, attributes, pixel, depth, fragIn, context);
+    if (pDebugData && pixel == mDebugPixel) {
+        std::lock_guard lock(mDebugMutex);
+        mDebugData = *pDebugData;
+        mDebugDataValid = true;
     }
+    batch.push(fragIn, context, mpColorTexture->fetch<float4>(pixel).ptr());
+}
 
-    // Prepare fragment and context data
-    FragIn fragIn = interpolateVertex;
-    GraphicsContextData context(primitive.id, samplePoint);
-    if (pDebugData) {
-        context.debugData = *pDebugData;
+void RasterPipeline::rasterizeSpan(int y, int xBegin, int xEnd, const TriangleSetup& setup, const TriangleAttributeSetup& attributes,
+                                   FragmentBatch& batch) {
+    if (y < 0 || y >= mDesc.height) return;
+    xBegin = std::max(xBegin, 0);
+    xEnd = std::min(xEnd, mDesc.width - 1);
+    if (xBegin > xEnd) return;
+
+    float* pDepthRow = mpDepthTexture->fetch<float>(0u, uint32_t(y)).ptr();
+
+    const SimdFloat4 zero(0.f), one(1.f);
+    const SimdFloat4 laneIndex(0.f, 1.f, 2.f, 3.f);
+    float sampleY = float(y) + 0.5f - setup.vpCrd[0].y;
+    const SimdFloat4 rowB1(setup.gradB1.y * sampleY), rowB2(setup.gradB2.y * sampleY);
+    const SimdFloat4 rowDepth(setup.vpCrd[0].z + setup.gradDepth.y * sampleY);
+
+    for (int x = xBegin; x <= xEnd; x += 4) {
+        int laneCount = std::min(4, xEnd - x + 1);
+        SimdFloat4 sampleX = SimdFloat4(float(x) + 0.5f - setup.vpCrd[0].x) + laneIndex;
+
+        // Coverage, same rule as isInsidePrimitive
+        SimdFloat4 b1 = rowB1 + sampleX * SimdFloat4(setup.gradB1.x);
+        SimdFloat4 b2 = rowB2 + sampleX * SimdFloat4(setup.gradB2.x);
+        SimdFloat4 b0 = one - b1 - b2;
+        SimdFloat4 mask = (b0 >= zero) & (b1 >= zero) & (b2 >= zero) & (b2 <= one) & (laneIndex < SimdFloat4(float(laneCount)));
+        int coverageMask = mask.moveMask();
+        if (coverageMask == 0) continue;
+        batch.counters().fragmentsTested += std::popcount(uint32_t(coverageMask));
+
+        // Depth test, RHS + ZO depth, the smaller the closer
+        SimdFloat4 depth = rowDepth + sampleX * SimdFloat4(setup.gradDepth.x);
+        alignas(16) float depthLanes[4] = {};
+        std::memcpy(depthLanes, pDepthRow + x, laneCount * sizeof(float));
+        SimdFloat4 oldDepth = SimdFloat4::load(depthLanes);
+        mask = mask & (depth > zero) & (depth <= one) & (depth < oldDepth);
+
+        int laneMask = mask.moveMask();
+        if (laneMask == 0) continue;
+        batch.counters().fragmentsPassed += std::popcount(uint32_t(laneMask));
+        select(mask, depth, oldDepth).store(depthLanes);
+        std::memcpy(pDepthRow + x, depthLanes, laneCount * sizeof(float));
+
+        // Interpolate attributes and shade passed lanes only
+        for (int lane = 0; lane < laneCount; lane++) {
+            if (laneMask & (1 << lane)) {
+                writeFragment(int2(x + lane, y), setup, attributes, depthLanes[lane], batch);
+            }
+        }
     }
-    mpColorTexture->fetch<float4>(pixel) = fragmentShader(fragIn, context);
-    rasterTimer.end();
-    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
 }
 
 static AABB computePrimitiveViewportAABB(const TrianglePrimitive& primitive, int width, int height) {
     AABB aabb;
-    aabb |= ndcToViewport(width, height, clipToNDC(primitive.v0.rasterPosition));
-    aabb |= ndcToViewport(width, height, clipToNDC(primitive.v1.rasterPosition));
-    aabb |= ndcToViewport(width, height, clipToNDC(primitive.v2.rasterPosition));
+    aabb |= ndcToViewport(width, height, clipToNDC(primitive.v0().rasterPosition));
+    aabb |= ndcToViewport(width, height, clipToNDC(primitive.v1().rasterPosition));
+    aabb |= ndcToViewport(width, height, clipToNDC(primitive.v2().rasterPosition));
     return aabb;
 }
 
-void RasterPipeline::prepareRasterization(const tbb::concurrent_vector<TrianglePrimitive>& primitives, BVH& bvh) {
-    if (useHiZ() && mpDepthTexture) {
-        // Create Hi-Z buffers
-        const auto& baseDesc = mpDepthTexture->getDesc();
-        int width = baseDesc.width, height = baseDesc.height;
-        RASTERY_ASSERT(width >= 0 && height >= 0);
-        int level = computeMipMpaLevels(width, height);
-        if (mHiZDepthTextures.size() < level) {
-            mHiZDepthTextures.resize(level);
-        }
-
-        mHiZDepthTextures[0] = mpDepthTexture;
-        width >>= 1;
-        height >>= 1;
-        bool hizRecreated = false;
-        for (int i = 1; i < level; i++) {
-            if (mHiZDepthTextures[i] == nullptr || mHiZDepthTextures[i]->getDesc().width != width ||
-                mHiZDepthTextures[i]->getDesc().height != height) {
-                TextureDesc desc = baseDesc;
-                desc.width = width;
-                desc.height = height;
-
-                mHiZDepthTextures[i] = std::make_shared<CpuTexture>(desc);
-                hizRecreated = true;
-            }
-            width >>= 1;
-            height >>= 1;
-        }
-
-        if (hizRecreated) {
-            logInfo("Recreating Hi-Z buffers");
-        }
-
-        // Clear Z buffers
-        float clearColor = mpDepthTexture->fetch<float>(0, 0);
-        for (int i = 1; i < level; i++) {
-            mHiZDepthTextures[i]->clear(float4(clearColor));
-        }
-    }
+void RasterPipeline::prepareRasterization(const std::vector<TrianglePrimitive>& primitives, BVH& bvh) {
+    if (useHiZ() && mpDepthTexture) prepareHiZBuffer();
 
     if (useAccelerationStructure()) {
         int width = mDesc.width;
@@ -482,11 +1115,17 @@ void RasterPipeline::prepareRasterization(const tbb::concurrent_vector<TriangleP
         for (int i = 0; i < bvh.getNodeCount(); i++) {
             bvh.getNode(i).primOffset = -1;
         }
-        // Update bvh leaf nodes
+        // Update bvh leaf nodes, clipping may split one Vao primitive into several, chain them up
+        mClippedPrimitiveLinks.assign(primitives.size(), -1);
         for (int i = 0; i < primitives.size(); i++) {
             const auto& prim = primitives[i];
             auto& bvhNode = bvh.getLeafNodeByVaoOffset(prim.id);
-            bvhNode.viewportAABB = computePrimitiveViewportAABB(prim, width, height);
+            AABB vpAABB = computePrimitiveViewportAABB(prim, width, height);
+            if (bvhNode.isPrimitiveValid()) {
+                vpAABB |= bvhNode.viewportAABB;
+                mClippedPrimitiveLinks[i] = bvhNode.primOffset;
+            }
+            bvhNode.viewportAABB = vpAABB;
             bvhNode.primOffset = i;
         }
 
@@ -494,91 +1133,167 @@ void RasterPipeline::prepareRasterization(const tbb::concurrent_vector<TriangleP
     }
 }
 
-static int approxLayerIndex(const AABB& vpAABB, int width, int height, int layerCnt) {
-    uint2 boundsSize = uint2(glm::clamp(float2(vpAABB.maxPoint), {0.0, 0.0}, {width, height})) -
-                       uint2(glm::clamp(float2(vpAABB.minPoint), {0.0, 0.0}, {width, height}));
-    // Find a layer whose texel size is larger than the bound size just fine
-    while ((boundsSize.x < width || boundsSize.y < height) && layerCnt > 0) {
-        layerCnt--;
-        width /= 2;
-        height /= 2;
-    }
-    return layerCnt;
+void RasterPipeline::setupTriangles(const std::vector<TrianglePrimitive>& primitives) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    mTriangleSetups.resize(primitives.size());
+    mAttributeSetups.resize(primitives.size());
+    tbb::parallel_for(0, (int)primitives.size(),
+                      [&](int i) { setupTriangle(primitives[i], width, height, mTriangleSetups[i], mAttributeSetups[i]); });
 }
 
-void RasterPipeline::executeRasterization(const tbb::concurrent_vector<TrianglePrimitive>& primitives, BVH& bvh,
-                                          FragmentShader fragmentShader) {
-    prepareRasterization(primitives, bvh);
-
-    Timer timer;
+template <RasterMode kRasterMode, bool kUseHiZ>
+void RasterPipeline::rasterizePrimitives(const std::vector<TrianglePrimitive>& primitives, BVH& bvh,
+                                         const FragmentShaderBatch& fragmentShader) {
+    // Size classified scheduling times its own stages, the BVH traversal takes precedence over it
+    if (kRasterMode == RasterMode::BoundedNaive && !(kUseHiZ && useAccelerationStructure())) {
+        rasterizeSizeClassified(primitives, kUseHiZ, fragmentShader);
+        return;
+    }
 
-    // Cull the pixels in screen space
-    if (mDesc.rasterMode == RasterMode::Naive || mDesc.rasterMode == RasterMode::BoundedNaive) {
-        if (useHiZ() && useAccelerationStructure()) {
-            std::vector<BVHNode*> stack;
-            stack.reserve(primitives.size());
-            stack.push_back(&bvh.getRootNode());
-            while (!stack.empty()) {
-                auto* node = stack.back();
-                stack.pop_back();
-
-                const AABB& vpAABB = node->viewportAABB;
-                // Choose a layer that texel size is nearly the same or larger than tha vpAABB
-                int layer = approxLayerIndex(vpAABB, mDesc.width, mDesc.height, mHiZDepthTextures.size());
-
-                if (!earlyHiZBufferTest(vpAABB, layer)) {
+    // Timed once for the whole stage, Hi-Z tests interleaved with the primitives count as raster time
+    Timer rasterTimer;
+    if (kUseHiZ && useAccelerationStructure()) {
+        struct TraversalItem {
+            BVHNode* pNode;
+            bool accepted;  ///< The whole subtree was in front of the Hi-Z, its nodes skip the test
+        };
+        std::vector<TraversalItem> stack;
+        stack.reserve(primitives.size());
+        stack.push_back({&bvh.getRootNode(), false});
+        while (!stack.empty()) {
+            BVHNode* node = stack.back().pNode;
+            bool accepted = stack.back().accepted;
+            stack.pop_back();
+
+            if (!accepted) {
+                updateHiZBuffer();
+                HiZResult result = mHiZBuffer.test(node->viewportAABB);
+                if (result == HiZResult::Occluded) {
                     node->isCulledLastFrame = true;
                     continue;
                 }
-                node->isCulledLastFrame = false;
-                if (node->isLeaf() && node->isPrimitiveValid() && node->primOffset < primitives.size()) {
-                    rasterizePrimitive(primitives[node->primOffset], fragmentShader);
-                    continue;
+                accepted = result == HiZResult::Accepted;
+            }
+            node->isCulledLastFrame = false;
+            if (node->isLeaf() && node->isPrimitiveValid() && node->primOffset < primitives.size()) {
+                for (int offset = node->primOffset; offset != -1; offset = mClippedPrimitiveLinks[offset]) {
+                    rasterizePrimitive<kRasterMode, kUseHiZ>(mTriangleSetups[offset], mAttributeSetups[offset], fragmentShader);
                 }
+                continue;
+            }
 
-                // Push child into stack reversed order
-                std::for_each(node->children.rbegin(), node->children.rend(), [&](int child) { stack.push_back(&bvh.getNode(child)); });
+            // Push child into stack reversed order
+            std::for_each(node->children.rbegin(), node->children.rend(),
+                          [&](int child) { stack.push_back({&bvh.getNode(child), accepted}); });
+        }
+    } else {
+        for (size_t i = 0; i < primitives.size(); i++) {
+            int width = mDesc.width;
+            int height = mDesc.height;
+            if constexpr (kUseHiZ) {
+                updateHiZBuffer();
+                if (mHiZBuffer.test(computePrimitiveViewportAABB(primitives[i], width, height)) == HiZResult::Occluded) continue;
             }
+            rasterizePrimitive<kRasterMode, kUseHiZ>(mTriangleSetups[i], mAttributeSetups[i], fragmentShader);
+        }
+    }
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+void RasterPipeline::executeRasterization(const std::vector<TrianglePrimitive>& primitives, BVH& bvh,
+                                          const FragmentShaderBatch& fragmentShader) {
+    Timer timer;
+    // Acceleration structures are timed as their own coarse stages, the culling tests inside the raster loops are raster time
+    Timer accelerationTimer;
+    prepareRasterization(primitives, bvh);
+    accelerationTimer.end();
+    mStats.accelerationTime += accelerationTimer.elapsedMilliseconds();
+
+    Timer setupTimer;
+    setupTriangles(primitives);
+    setupTimer.end();
+    mStats.triangleSetupTime += setupTimer.elapsedMilliseconds();
+
+    // Raster mode and Hi-Z are resolved once here, the per primitive path is specialized on them
+    bool hiZ = useHiZ();
+    if (mDesc.conservativeMode != ConservativeMode::None && !supportsConservativeRaster()) {
+        logFatal("Conservative raster is not supported by raster mode {} with MSAA {}", enumToString(mDesc.rasterMode),
+                 enumToString(mDesc.sampleCount));
+    }
+    if (mDesc.sampleCount != SampleCount::x1) {
+        multisampleTiled(primitives, fragmentShader);
+    } else if (mDesc.rasterMode == RasterMode::Naive) {
+        if (hiZ) {
+            rasterizePrimitives<RasterMode::Naive, true>(primitives, bvh, fragmentShader);
         } else {
-            for (const auto& primitive : primitives) {
-                int width = mDesc.width;
-                int height = mDesc.height;
-                if (useHiZ() && !earlyHiZBufferTest(computePrimitiveViewportAABB(primitive, width, height))) {
-                    continue;
-                }
-                rasterizePrimitive(primitive, fragmentShader);
-            }
+            rasterizePrimitives<RasterMode::Naive, false>(primitives, bvh, fragmentShader);
+        }
+    } else if (mDesc.rasterMode == RasterMode::BoundedNaive) {
+        if (hiZ) {
+            rasterizePrimitives<RasterMode::BoundedNaive, true>(primitives, bvh, fragmentShader);
+        } else {
+            rasterizePrimitives<RasterMode::BoundedNaive, false>(primitives, bvh, fragmentShader);
+        }
+    } else if (mDesc.rasterMode == RasterMode::HalfSpace) {
+        if (hiZ) {
+            rasterizePrimitives<RasterMode::HalfSpace, true>(primitives, bvh, fragmentShader);
+        } else {
+            rasterizePrimitives<RasterMode::HalfSpace, false>(primitives, bvh, fragmentShader);
         }
     } else if (mDesc.rasterMode == RasterMode::ScanLineZBuffer) {
         scanlineZBuffer(primitives, fragmentShader);
+    } else if (mDesc.rasterMode == RasterMode::IntervalScanLine) {
+        intervalScanline(primitives, fragmentShader);
+    } else if (mDesc.rasterMode == RasterMode::TiledBinning) {
+        tiledBinning(primitives, fragmentShader);
+    } else if (mDesc.rasterMode == RasterMode::VisibilityBuffer) {
+        visibilityBuffer(primitives, fragmentShader);
+    } else if (mDesc.rasterMode == RasterMode::PrimitiveParallel) {
+        primitiveParallel(primitives, fragmentShader);
+    }
+
+    // Leave the pyramid complete for the next draw, draws that did not maintain it force a rebuild
+    accelerationTimer.begin();
+    if (hiZ) {
+        updateHiZBuffer(true);
+    } else {
+        mHiZBuffer.invalidate();
     }
+    accelerationTimer.end();
+    mStats.accelerationTime += accelerationTimer.elapsedMilliseconds();
 
     timer.end();
     mStats.drawCallCount++;
     mStats.commitedPrimitiveCount += (uint32_t)primitives.size();
     mStats.fullRasterizeTime += timer.elapsedMilliseconds();
-    mStats.accelerationTime += mStats.fullRasterizeTime - mStats.primitiveRasterizeTime;
 }
 
 struct PrimitiveItem {
-    const TrianglePrimitive* pPrimitive;
-    std::array<float3, 3> vpCrd;  ///< view port coordinates for barycentric coordinate compute
+    uint32_t primIndex;  ///< Index of the primitive and its triangle setup
     int dy;
+    int y;                         ///< First scanline of the primitive, -1 if the primitive is not scanned
+    std::array<EdgeItem, 3> edges;  ///< Classified edges in classification order
+    int edgeCount;
 };
 
-using ClassifiedPrimitiveTable = std::vector<std::vector<PrimitiveItem>>;
-using ClassifiedEdgeTable = std::vector<std::unordered_map<const TrianglePrimitive*, std::vector<EdgeItem>>>;
+/** Flat classified primitive table, items are bucketed by their first scanline.
+ */
+struct ClassifiedPrimitiveTable {
+    std::span<PrimitiveItem> items;
+    std::span<uint32_t> rowOffsets;  ///< Items starting at scanline y are [rowOffsets[y], rowOffsets[y + 1])
+};
 
-struct ActiveEdgePairItem {
+struct ActivePrimitiveItem {
+    uint32_t itemIndex;  ///< Index into classified primitive items
+    int dy;              ///< Remaining scanline count
     std::pair<EdgeItem, EdgeItem> edgePair;
-    float depth;
 };
 
-using ActivePrimitiveTable = std::vector<PrimitiveItem>;
-using ActiveEdgePairTable = std::unordered_map<const TrianglePrimitive*, ActiveEdgePairItem>;
+using ActivePrimitiveTable = std::vector<ActivePrimitiveItem>;
 
-static bool prepareEdgeItem(const TrianglePrimitive& primitive, const float2& p0, const float2& p1, int width, int height,
-                            ClassifiedEdgeTable& table) {
+static bool prepareEdgeItem(const TrianglePrimitive& primitive, const float2& p0, const float2& p1, int height, PrimitiveItem& primItem) {
     EdgeItem item;
     item.pPrimitive = &primitive;
     item.x = p0.x;
@@ -601,137 +1316,1077 @@ static bool prepareEdgeItem(const TrianglePrimitive& primitive, const float2& p0
     }
     item.x -= (p0.y - std::floor(p0.y)) * item.dx;
     item.x0 = item.x;
-    table[y][&primitive].push_back(item);
+    item.y = y;
+    primItem.edges[primItem.edgeCount++] = item;
     return true;
 }
 
-void RasterPipeline::scanlineZBuffer(const tbb::concurrent_vector<TrianglePrimitive>& primitives, FragmentShader fragmentShader) {
-    int width = mDesc.width;
-    int height = mDesc.height;
-    mStats.actualDrawCount++;
-
-    ClassifiedPrimitiveTable cpt(height, {});
-    ClassifiedEdgeTable cet(height, {});
-
-    // 1. Build classified polygon&edge table
-    for (const TrianglePrimitive& primitive : primitives) {
-        std::array<float3, 3> vpCrd;
-        vpCrd[0] = ndcToViewport(width, height, clipToNDC(primitive.v0.rasterPosition));
-        vpCrd[1] = ndcToViewport(width, height, clipToNDC(primitive.v1.rasterPosition));
-        vpCrd[2] = ndcToViewport(width, height, clipToNDC(primitive.v2.rasterPosition));
-        PrimitiveItem item;
-        item.vpCrd = vpCrd;
+/** Gather the edges of a primitive classified at scanline y.
+ * @return edge count.
+ */
+static int gatherEdges(const PrimitiveItem& item, int y, std::array<EdgeItem, 3>& edges) {
+    int count = 0;
+    for (int i = 0; i < item.edgeCount; i++) {
+        if (item.edges[i].y == y) {
+            edges[count++] = item.edges[i];
+        }
+    }
+    return count;
+}
+
+static constexpr int kScanlineBandHeight = 32;  ///< Scanline rows processed by one worker
+
+/** Create the active primitive from the edges classified at its first scanline.
+ */
+static ActivePrimitiveItem createActivePrimitive(const PrimitiveItem& item, uint32_t itemIndex) {
+    std::array<EdgeItem, 3> edges;
+    int edgeCount = gatherEdges(item, item.y, edges);
+    if (edgeCount == 1 || edgeCount == 0) {
+        logFatal("Invalid edge pair size = {}", edgeCount);
+    }
+
+    // 3 edges starts at the same place, edges are sorted by dy when classified
+    // Put in the tallest and shortest ones
+    EdgeItem it0 = edges[0], it1 = edgeCount == 3 ? edges[2] : edges[1];
+    if (it0.x > it1.x || (it0.x == it1.x && (it0.dy > it1.dy))) {
+        std::swap(it0, it1);
+    }
+    ActivePrimitiveItem activePrim;
+    activePrim.itemIndex = itemIndex;
+    activePrim.dy = item.dy;
+    activePrim.edgePair = {it0, it1};
+    return activePrim;
+}
+
+/** Active primitive at scanline y of a primitive started above it, edges are evaluated at y from their classified start.
+ */
+static ActivePrimitiveItem seedActivePrimitive(const PrimitiveItem& item, uint32_t itemIndex, int y) {
+    std::array<EdgeItem, 3> edges;
+    int edgeCount = 0;
+    for (int i = 0; i < item.edgeCount; i++) {
+        EdgeItem edge = item.edges[i];
+        int steps = y - edge.y;
+        if (steps < 0 || steps >= edge.dy) continue;
+        edge.x = edge.x0 + edge.dx * float(steps);
+        edge.dy -= steps;
+        edges[edgeCount++] = edge;
+    }
+    if (edgeCount < 2) {
+        logFatal("Invalid edge pair size = {}", edgeCount);
+    }
+
+    if (edgeCount == 3) {
+        // Both short edges cross the scanline of the middle vertex, keep the upper one as stepping does.
+        // Edges starting together are sorted by dy when classified, keep the shortest and the tallest then
+        sort3(edges[0], edges[1], edges[2], [](const EdgeItem& it0, const EdgeItem& it1) {
+            return it0.y < it1.y || (it0.y == it1.y && it0.dy < it1.dy);
+        });
+        if (edges[2].y == edges[0].y) edges[1] = edges[2];
+    }
+    EdgeItem it0 = edges[0], it1 = edges[1];
+    if (it0.x > it1.x || (it0.x == it1.x && (it0.dy > it1.dy))) {
+        std::swap(it0, it1);
+    }
+    ActivePrimitiveItem activePrim;
+    activePrim.itemIndex = itemIndex;
+    activePrim.dy = item.dy - (y - item.y);
+    activePrim.edgePair = {it0, it1};
+    return activePrim;
+}
+
+/** Step the active primitive and its edge pair from scanline y to the next one.
+ * @return false if the primitive has been fully scanned.
+ */
+static bool stepActivePrimitive(ActivePrimitiveItem& activePrim, const PrimitiveItem& item, int y) {
+    auto& [edge0, edge1] = activePrim.edgePair;
+    edge0.x += edge0.dx;
+    edge1.x += edge1.dx;
+    int dyLeft = --edge0.dy;
+    int dyRight = --edge1.dy;
+
+    activePrim.dy--;
+    if (activePrim.dy <= 0) {
+        return false;
+    }
+
+    if (dyLeft <= 0 || dyRight <= 0) {
+        std::array<EdgeItem, 3> edges;
+        int edgeCount = gatherEdges(item, y, edges);
+        if (edgeCount > 0) {
+            // Find a new edge to replace it
+            EdgeItem newEdge = edges[edgeCount == 3 ? 1 : 0];
+            std::swap(dyLeft <= 0 ? edge0 : edge1, newEdge);
+        }
+    }
+    if (edge0.x > edge1.x) {
+        std::swap(edge0, edge1);
+    }
+    return true;
+}
+
+/** Build classified primitive table, every item carries its classified edges.
+ */
+static ClassifiedPrimitiveTable classifyPrimitives(const std::vector<TrianglePrimitive>& primitives,
+                                                   std::span<const TriangleSetup> setups, int height, FrameArena& arena) {
+    // 1. Build classified polygon&edge items
+    std::span<PrimitiveItem> classified = arena.allocate<PrimitiveItem>(primitives.size());
+    tbb::parallel_for(0, (int)primitives.size(), [&](int i) {
+        const TrianglePrimitive& primitive = primitives[i];
+        std::array<float3, 3> vpCrd = setups[i].vpCrd;
+        PrimitiveItem& item = classified[i];
+        item.primIndex = uint32_t(i);
+        item.y = -1;
+        item.edgeCount = 0;
         // bubble sort vertices by y
         sort3(vpCrd[0], vpCrd[1], vpCrd[2], [](const float2& v1, const float2& v2) { return v1.y < v2.y; });
 
         int minY = std::floor(vpCrd[0].y);
         minY = std::max(0, minY);
         int maxY = std::ceil(vpCrd[2].y);
-        if (minY < height && maxY >= 0) {
-            // Update classified polygon table
-            item.pPrimitive = &primitive;
+        // Degenerate primitives have no gradients in their setup, they are never bucketed
+        if (setups[i].valid && minY < height && maxY >= 0) {
             item.dy = maxY - minY;
-            cpt[minY].push_back(item);
-
-            // Update classified edge table
-            prepareEdgeItem(primitive, vpCrd[0], vpCrd[1], width, height, cet);
-            prepareEdgeItem(primitive, vpCrd[0], vpCrd[2], width, height, cet);
-            prepareEdgeItem(primitive, vpCrd[1], vpCrd[2], width, height, cet);
+            item.y = minY;
+
+            prepareEdgeItem(primitive, vpCrd[0], vpCrd[1], height, item);
+            prepareEdgeItem(primitive, vpCrd[0], vpCrd[2], height, item);
+            prepareEdgeItem(primitive, vpCrd[1], vpCrd[2], height, item);
+            if (item.edgeCount == 3 && item.edges[0].y == item.edges[1].y && item.edges[1].y == item.edges[2].y) {
+                // 3 edges starts at the same scanline, sort them by dy
+                sort3(item.edges[0], item.edges[1], item.edges[2],
+                      [](const EdgeItem& it0, const EdgeItem& it1) { return it0.dy < it1.dy; });
+            }
         }
-    }
+    });
 
-    // 2. Do scanline rasterization
-    ActivePrimitiveTable activePrims;
-    ActiveEdgePairTable activeEdgePairs;
+    // 2. Bucket items by first scanline with a stable counting sort, primitives keep their depth order in a bucket
+    ClassifiedPrimitiveTable cpt;
+    cpt.rowOffsets = arena.allocate<uint32_t>(height + 1, 0u);
+    for (const auto& item : classified) {
+        if (item.y >= 0) cpt.rowOffsets[item.y + 1]++;
+    }
     for (int y = 0; y < height; y++) {
-        // Update active table
-        const auto& primTable = cpt[y];
-        auto& edgeTable = cet[y];
+        cpt.rowOffsets[y + 1] += cpt.rowOffsets[y];
+    }
+    cpt.items = arena.allocate<PrimitiveItem>(cpt.rowOffsets.back());
+    {
+        std::span<uint32_t> cursor = arena.allocate<uint32_t>(height);
+        std::copy_n(cpt.rowOffsets.begin(), height, cursor.begin());
+        for (const auto& item : classified) {
+            if (item.y >= 0) cpt.items[cursor[item.y]++] = item;
+        }
+    }
+    return cpt;
+}
 
-        for (const auto& prim : primTable) {
-            const auto* pId = prim.pPrimitive;
-            if (edgeTable.find(pId) == edgeTable.end()) {
-                logFatal("Can't find edge of primitive!");
+/** Walk all scanlines in parallel bands, each band keeps its own active table.
+ * rowFunc(y, activePrims) is called for every scanline with the primitives active on it.
+ */
+template <typename RowFunc>
+static void scanBands(const ClassifiedPrimitiveTable& cpt, int height, FrameArena& arena, RowFunc&& rowFunc) {
+    // Collect items entering each band from above, in the order they were activated
+    int bandCount = (height + kScanlineBandHeight - 1) / kScanlineBandHeight;
+    std::span<uint32_t> seedOffsets = arena.allocate<uint32_t>(bandCount + 1, 0u);
+    auto forEachSeed = [&](auto&& func) {
+        for (uint32_t i = 0; i < cpt.items.size(); i++) {
+            const auto& item = cpt.items[i];
+            int lastBand = std::min(bandCount - 1, (item.y + item.dy - 1) / kScanlineBandHeight);
+            for (int band = item.y / kScanlineBandHeight + 1; band <= lastBand; band++) {
+                func(band, i);
             }
+        }
+    };
+    forEachSeed([&](int band, uint32_t) { seedOffsets[band + 1]++; });
+    for (int band = 0; band < bandCount; band++) {
+        seedOffsets[band + 1] += seedOffsets[band];
+    }
+    std::span<uint32_t> seeds = arena.allocate<uint32_t>(seedOffsets.back());
+    {
+        std::span<uint32_t> cursor = arena.allocate<uint32_t>(bandCount);
+        std::copy_n(seedOffsets.begin(), bandCount, cursor.begin());
+        forEachSeed([&](int band, uint32_t itemIndex) { seeds[cursor[band]++] = itemIndex; });
+    }
 
-            auto& edgePair = edgeTable.at(prim.pPrimitive);
-            if (edgePair.size() == 1 || edgePair.size() == 0) {
-                logFatal("Invalid edge pair size = {}", edgePair.size());
-            }
+    tbb::parallel_for(0, bandCount, [&](int band) {
+        int yBegin = band * kScanlineBandHeight;
+        int yEnd = std::min(height, yBegin + kScanlineBandHeight);
 
-            activePrims.push_back(prim);
+        ActivePrimitiveTable activePrims;
 
-            auto addEdgePair = [&](EdgeItem it0, EdgeItem it1) {
-                ActiveEdgePairItem activeEdgePair;
-                if (it0.x > it1.x || (it0.x == it1.x && (it0.dy > it1.dy))) {
-                    std::swap(it0, it1);
-                }
-                activeEdgePair.edgePair = {it0, it1};
+        // Seed active table with primitives started above the band, their edges are evaluated at the first band row
+        for (uint32_t i = seedOffsets[band]; i < seedOffsets[band + 1]; i++) {
+            activePrims.push_back(seedActivePrimitive(cpt.items[seeds[i]], seeds[i], yBegin));
+        }
+
+        for (int y = yBegin; y < yEnd; y++) {
+            // Update active table
+            for (uint32_t i = cpt.rowOffsets[y]; i < cpt.rowOffsets[y + 1]; i++) {
+                activePrims.push_back(createActivePrimitive(cpt.items[i], i));
+            }
 
-                activeEdgePairs[pId] = activeEdgePair;
-            };
+            rowFunc(y, std::span<const ActivePrimitiveItem>(activePrims));
 
-            if (edgePair.size() == 3) {
-                // 3 edges starts at the same place
-                // Put in the tallest and shortest ones
-                sort3(edgePair[0], edgePair[1], edgePair[2], [](const EdgeItem& it0, const EdgeItem& it1) { return it0.dy < it1.dy; });
-                addEdgePair(edgePair[0], edgePair[2]);
-            } else {
-                addEdgePair(edgePair[0], edgePair[1]);
+            // Step and compact the active table in place
+            size_t activeCount = 0;
+            for (auto& activePrim : activePrims) {
+                if (stepActivePrimitive(activePrim, cpt.items[activePrim.itemIndex], y)) {
+                    activePrims[activeCount++] = activePrim;
+                }
             }
+            activePrims.resize(activeCount);
         }
+    });
+}
 
-        ActivePrimitiveTable activePrimsNew;
-        activePrimsNew.reserve(activePrims.size());
+void RasterPipeline::scanlineZBuffer(const std::vector<TrianglePrimitive>& primitives,
+                                     const FragmentShaderBatch& fragmentShader) {
+    int height = mDesc.height;
+    mStatistics.local().drawnPrimitiveCount++;
 
-        for (auto& activePrim : activePrims) {
-            const auto* pId = activePrim.pPrimitive;
-            auto aepIt = activeEdgePairs.find(pId);
-            if (aepIt == activeEdgePairs.end()) {
-                logFatal("Can't find edge pair of primitive!");
-            }
-            auto& activeEdgePair = aepIt->second;
-            auto& [edge0, edge1] = activeEdgePair.edgePair;
+    ClassifiedPrimitiveTable cpt = classifyPrimitives(primitives, mTriangleSetups, height, mFrameArena);
+
+    Timer rasterTimer;
+    scanBands(cpt, height, mFrameArena, [&](int y, std::span<const ActivePrimitiveItem> activePrims) {
+        // Rows are owned by one band, fragments of the whole row can share a batch
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        for (const auto& activePrim : activePrims) {
+            const auto& item = cpt.items[activePrim.itemIndex];
+            const auto& [edge0, edge1] = activePrim.edgePair;
 
-            if (edge0.x > edge1.x) {
-                std::swap(edge0, edge1);
-            }
             int upperX0 = std::floor(edge0.x), upperX1 = std::ceil(edge1.x);
             int lowerX0 = std::floor(edge0.x + edge0.dx), lowerX1 = std::ceil(edge1.x + edge1.dx);
 
             int xLeft = std::min<int>({upperX0, lowerX0, upperX1, lowerX1});
             int xRight = std::max<int>({upperX0, lowerX0, upperX1, lowerX1});
+            // Debug data is only built for the span crossing the debug pixel
+            RasterizerDebugData debugData;
+            bool isDebugSpan = y == mDebugPixel.y && mDebugPixel.x >= xLeft && mDebugPixel.x <= xRight;
+            if (isDebugSpan) {
+                debugData.activeEdgePair[0] = edge0;
+                debugData.activeEdgePair[1] = edge1;
+            }
+
             // Rasterize point
-            auto debugData = RasterizerDebugData();
-            debugData.activeEdgePair[0] = edge0;
-            debugData.activeEdgePair[1] = edge1;
             for (int x = xLeft; x <= xRight; x++) {
                 int2 pixel = int2(x, y);
-                // mpColorTexture->fetch<float4>(pixel) = float4(pseudoColor(pId->id), 1);
-
-                rasterizePoint(pixel, activePrim.vpCrd, *pId, fragmentShader, &debugData);
-            }
-            edge0.x += edge0.dx;
-            edge1.x += edge1.dx;
-            int dyLeft = --edge0.dy;
-            int dyRight = --edge1.dy;
-
-            activePrim.dy--;
-            if (activePrim.dy <= 0) {
-                activeEdgePairs.erase(aepIt);
-            } else {
-                activePrimsNew.push_back(activePrim);
-                auto cetIt = cet[y].find(pId);
-                if ((dyLeft <= 0 || dyRight <= 0) && cetIt != cet[y].end() && !cetIt->second.empty()) {
-                    // Find a new edge to replace it
-                    EdgeItem newEdge = cetIt->second[cetIt->second.size() == 3 ? 1 : 0];
-                    std::swap(dyLeft <= 0 ? edge0 : edge1, newEdge);
+                rasterizePoint(pixel, mTriangleSetups[item.primIndex], mAttributeSetups[item.primIndex], batch,
+                               isDebugSpan ? &debugData : nullptr);
+            }
+        }
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+/** Pixel range [first, second) whose centers lie in [xMin, xMax].
+ */
+static std::pair<int, int> pixelCenterRange(float xMin, float xMax, int width) {
+    if (!(xMin <= xMax)) return {0, 0};
+    int xBegin = (int)std::max(0.f, std::ceil(xMin - 0.5f));
+    int xEnd = (int)std::min(float(width), std::floor(xMax - 0.5f) + 1.f);
+    return {xBegin, std::max(xBegin, xEnd)};
+}
+
+/** Pixel range [first, second) whose centers on the row are inside all three edge functions, solved in closed form.
+ */
+static std::pair<int, int> solveScanlineSpan(const TriangleSetup& setup, float sampleY, int width) {
+    // Along the row every barycentric weight is b(0) + x * gradB.x, each one bounds x from one side
+    float3 baryCoord = evaluateBarycentric(setup, float2(0.f, sampleY));
+    float3 slope(-(setup.gradB1.x + setup.gradB2.x), setup.gradB1.x, setup.gradB2.x);
+    float xMin = -std::numeric_limits<float>::infinity(), xMax = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 3; i++) {
+        if (slope[i] > 0) {
+            xMin = std::max(xMin, -baryCoord[i] / slope[i]);
+        } else if (slope[i] < 0) {
+            xMax = std::min(xMax, -baryCoord[i] / slope[i]);
+        } else if (baryCoord[i] < 0) {
+            return {0, 0};
+        }
+    }
+    return pixelCenterRange(xMin, xMax, width);
+}
+
+/** Pixel range [first, second) whose centers on scanline y are covered by the active primitive.
+ * The edge pair lines bound the span at the row center, rows holding a vertex are solved from the edge functions.
+ */
+static std::pair<int, int> computeScanlineSpan(const ActivePrimitiveItem& activePrim, const TriangleSetup& setup, int y, int width) {
+    const auto& [edge0, edge1] = activePrim.edgePair;
+    float sampleY = float(y) + 0.5f;
+    // An edge of the pair starts or ends inside the row, its line may run past the vertex
+    if (edge0.y == y || edge1.y == y || edge0.dy <= 1 || edge1.dy <= 1) {
+        return solveScanlineSpan(setup, sampleY, width);
+    }
+    // Edges are evaluated from their classified start, the stepped x is only kept for the row top
+    float x0 = edge0.x0 + edge0.dx * (sampleY - float(edge0.y));
+    float x1 = edge1.x0 + edge1.dx * (sampleY - float(edge1.y));
+    return pixelCenterRange(std::min(x0, x1), std::max(x0, x1), width);
+}
+
+struct SpanEvent {
+    int x;
+    uint32_t itemIndex;
+    bool isBegin;
+};
+
+/** Pixels of an interval whose nearest span has been resolved at both ends.
+ */
+struct IntervalRun {
+    int xBegin;  ///< Inclusive pixel range
+    int xEnd;
+    uint32_t nearestBegin;  ///< Nearest span at xBegin/xEnd, kNoSpan if every span is out of the depth range
+    uint32_t nearestEnd;
+};
+
+static constexpr uint32_t kNoSpan = ~0u;
+
+void RasterPipeline::intervalScanline(const std::vector<TrianglePrimitive>& primitives,
+                                      const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    bool writeDepth = mDesc.writeIntervalDepth;
+    mStatistics.local().drawnPrimitiveCount++;
+
+    // Visibility is resolved from the span depth planes, the depth buffer is never read
+    ClassifiedPrimitiveTable cpt = classifyPrimitives(primitives, mTriangleSetups, height, mFrameArena);
+    auto setupOf = [&](uint32_t itemIndex) -> const TriangleSetup& { return mTriangleSetups[cpt.items[itemIndex].primIndex]; };
+
+    // Nearest open span at a pixel center, ties go to the earlier primitive like the strict depth test of the other modes
+    auto findNearest = [&](std::span<const uint32_t> openSpans, int x, float sampleY) {
+        uint32_t nearest = kNoSpan;
+        float nearestDepth = std::numeric_limits<float>::infinity();
+        for (uint32_t itemIndex : openSpans) {
+            float depth = evaluateDepth(setupOf(itemIndex), float2(float(x) + 0.5f, sampleY));
+            // RHS + ZO depth, the smaller the closer
+            if (depth <= 0 || depth > 1 || depth > nearestDepth) continue;
+            if (depth == nearestDepth && cpt.items[itemIndex].primIndex > cpt.items[nearest].primIndex) continue;
+            nearestDepth = depth;
+            nearest = itemIndex;
+        }
+        return nearest;
+    };
+
+    struct ScanlineScratch {
+        std::vector<SpanEvent> events;
+        std::vector<uint32_t> openSpans;
+        std::vector<IntervalRun> runs;
+    };
+    tbb::enumerable_thread_specific<ScanlineScratch> scratches;
+
+    Timer rasterTimer;
+    scanBands(cpt, height, mFrameArena, [&](int y, std::span<const ActivePrimitiveItem> activePrims) {
+        auto& [events, openSpans, runs] = scratches.local();
+        events.clear();
+        openSpans.clear();
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        PipelineCounters& counters = batch.counters();
+        // Rows are owned by one band, the depth row is written without synchronization
+        float* pDepthRow = writeDepth ? mpDepthTexture->fetch<float>(0u, uint32_t(y)).ptr() : nullptr;
+        float sampleY = float(y) + 0.5f;
+
+        // 1. Spans of active primitives on this scanline, bounded by their active edge pair
+        for (const auto& activePrim : activePrims) {
+            const TriangleSetup& setup = setupOf(activePrim.itemIndex);
+            if (!setup.valid) continue;
+            auto [xBegin, xEnd] = computeScanlineSpan(activePrim, setup, y, width);
+            if (xBegin >= xEnd) continue;
+            events.push_back({xBegin, activePrim.itemIndex, true});
+            events.push_back({xEnd, activePrim.itemIndex, false});
+        }
+        std::sort(events.begin(), events.end(), [](const SpanEvent& e0, const SpanEvent& e1) {
+            return e0.x < e1.x || (e0.x == e1.x && e0.itemIndex < e1.itemIndex);
+        });
+
+        // 2. Sweep intervals between span crossings
+        for (size_t i = 0; i < events.size();) {
+            int x = events[i].x;
+            for (; i < events.size() && events[i].x == x; i++) {
+                if (events[i].isBegin) {
+                    openSpans.push_back(events[i].itemIndex);
+                } else {
+                    auto it = std::find(openSpans.begin(), openSpans.end(), events[i].itemIndex);
+                    *it = openSpans.back();
+                    openSpans.pop_back();
+                }
+            }
+            if (openSpans.empty() || i == events.size()) continue;
+
+            int xNext = events[i].x;
+            // Every open span covers the whole interval
+            counters.fragmentsTested += uint64_t(openSpans.size()) * uint64_t(xNext - x);
+
+            // 3. Depth is planar in every span, so a span nearest at both ends of a run is nearest over the whole run.
+            // Otherwise split the run where the depth planes of its two end spans cross, until both ends agree
+            runs.clear();
+            runs.push_back({x, xNext - 1, findNearest(openSpans, x, sampleY), findNearest(openSpans, xNext - 1, sampleY)});
+            while (!runs.empty()) {
+                IntervalRun run = runs.back();
+                runs.pop_back();
+                if (run.nearestBegin != run.nearestEnd) {
+                    int xSplit = (run.xBegin + run.xEnd) / 2;
+                    if (run.nearestBegin != kNoSpan && run.nearestEnd != kNoSpan) {
+                        // Last pixel center before the crossing, dBegin(x) - dEnd(x) = c + slope * x along the row
+                        const TriangleSetup& setupBegin = setupOf(run.nearestBegin);
+                        const TriangleSetup& setupEnd = setupOf(run.nearestEnd);
+                        float c = evaluateDepth(setupBegin, float2(0.f, sampleY)) - evaluateDepth(setupEnd, float2(0.f, sampleY));
+                        float slope = setupBegin.gradDepth.x - setupEnd.gradDepth.x;
+                        float xCross = -c / slope - 0.5f;
+                        if (xCross >= float(run.xBegin) && xCross < float(run.xEnd)) xSplit = (int)std::floor(xCross);
+                    }
+                    runs.push_back({xSplit + 1, run.xEnd, findNearest(openSpans, xSplit + 1, sampleY), run.nearestEnd});
+                    runs.push_back({run.xBegin, xSplit, run.nearestBegin, findNearest(openSpans, xSplit, sampleY)});
+                    continue;
+                }
+                if (run.nearestBegin == kNoSpan) continue;
+
+                // 4. Shade the run with its visible primitive, no per pixel depth test
+                const TriangleSetup& setup = setupOf(run.nearestBegin);
+                const TriangleAttributeSetup& attributes = mAttributeSetups[cpt.items[run.nearestBegin].primIndex];
+                float depth = evaluateDepth(setup, float2(float(run.xBegin) + 0.5f, sampleY));
+                counters.fragmentsPassed += uint64_t(run.xEnd - run.xBegin + 1);
+                if (writeDepth) {
+                    // Resolved depth is written once per run, never read back
+                    for (int px = run.xBegin; px <= run.xEnd; px++) pDepthRow[px] = depth + setup.gradDepth.x * float(px - run.xBegin);
                 }
+                for (int px = run.xBegin; px <= run.xEnd; px++) {
+                    writeFragment(int2(px, y), setup, attributes, depth + setup.gradDepth.x * float(px - run.xBegin), batch);
+                }
+            }
+        }
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+static constexpr int kTileSize = 32;  ///< Screen tile size in pixels used by tiled binning
+
+struct BinnedPrimitive {
+    int2 pixelMin;  ///< Covered pixel range, clamped to the framebuffer
+    int2 pixelMax;
+    bool visible;
+};
+
+/** Primitives binned into screen tiles, primitives of tile i are indices[offsets[i], offsets[i + 1]).
+ */
+struct TileBins {
+    int tileCountX;
+    int tileCountY;
+    uint32_t binnedPrimitiveCount;        ///< Primitives that landed in at least one tile
+    std::span<BinnedPrimitive> binned;  ///< Indexed the same as the primitive list
+    std::span<uint32_t> offsets;
+    std::span<uint32_t> indices;
+
+    [[nodiscard]] int tileCount() const { return tileCountX * tileCountY; }
+};
+
+/** Bin primitives into screen tiles, primitives occluded by the Hi-Z pyramid are dropped if one is given.
+ */
+static TileBins binPrimitives(const std::vector<TrianglePrimitive>& primitives, std::span<const TriangleSetup> setups, int width,
+                              int height, FrameArena& arena, const HiZBuffer* pHiZBuffer = nullptr) {
+    TileBins bins;
+    bins.tileCountX = (width + kTileSize - 1) / kTileSize;
+    bins.tileCountY = (height + kTileSize - 1) / kTileSize;
+    bins.binnedPrimitiveCount = 0;
+    int tileCount = bins.tileCount();
+
+    // 1. Compute covered pixel range of each primitive
+    bins.binned = arena.allocate<BinnedPrimitive>(primitives.size());
+    tbb::parallel_for(0, (int)primitives.size(), [&](int i) {
+        auto& binned = bins.binned[i];
+        AABB aabb;
+        for (const float3& p : setups[i].vpCrd) aabb |= p;
+        binned.visible = setups[i].valid && !isOutsideViewport(aabb, width, height);
+        if (binned.visible && pHiZBuffer) binned.visible = pHiZBuffer->test(aabb) != HiZResult::Occluded;
+        auto [pixelMin, pixelMax] = computePixelRange(aabb, width, height);
+        binned.pixelMin = pixelMin;
+        binned.pixelMax = pixelMax;
+    });
+
+    // 2. Bin primitives into tiles with a counting sort, primitives keep their (depth sorted) order inside a tile
+    bins.offsets = arena.allocate<uint32_t>(tileCount + 1, 0u);
+    for (const auto& binned : bins.binned) {
+        if (!binned.visible) continue;
+        int2 tileMin = binned.pixelMin / kTileSize, tileMax = binned.pixelMax / kTileSize;
+        for (int ty = tileMin.y; ty <= tileMax.y; ty++) {
+            for (int tx = tileMin.x; tx <= tileMax.x; tx++) {
+                bins.offsets[ty * bins.tileCountX + tx + 1]++;
+            }
+        }
+    }
+    for (int i = 0; i < tileCount; i++) {
+        bins.offsets[i + 1] += bins.offsets[i];
+    }
+
+    bins.indices = arena.allocate<uint32_t>(bins.offsets.back());
+    std::span<uint32_t> cursor = arena.allocate<uint32_t>(tileCount);
+    std::copy_n(bins.offsets.begin(), tileCount, cursor.begin());
+    for (uint32_t i = 0; i < bins.binned.size(); i++) {
+        const auto& binned = bins.binned[i];
+        if (!binned.visible) continue;
+        int2 tileMin = binned.pixelMin / kTileSize, tileMax = binned.pixelMax / kTileSize;
+        for (int ty = tileMin.y; ty <= tileMax.y; ty++) {
+            for (int tx = tileMin.x; tx <= tileMax.x; tx++) {
+                bins.indices[cursor[ty * bins.tileCountX + tx]++] = i;
             }
         }
-        activePrimsNew.shrink_to_fit();
-        std::swap(activePrimsNew, activePrims);
+        bins.binnedPrimitiveCount++;
     }
+    return bins;
+}
+
+static constexpr int kDepthBlockSize = 8;  ///< Pixels along each axis of a block with tracked depth bounds
+static constexpr int kDepthBlocksPerTile = kTileSize / kDepthBlockSize;
+
+/** Nearest(x) and farthest(y) depth of every 8x8 block of a tile, kept up to date while the tile is rasterized.
+ */
+using TileDepthBounds = std::array<float2, kDepthBlocksPerTile * kDepthBlocksPerTile>;
+
+static void initTileDepthBounds(std::span<const float> tileDepth, int2 tileSize, TileDepthBounds& bounds) {
+    bounds.fill(float2(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()));
+    for (int y = 0; y < tileSize.y; y++) {
+        for (int x = 0; x < tileSize.x; x++) {
+            float2& block = bounds[(y / kDepthBlockSize) * kDepthBlocksPerTile + x / kDepthBlockSize];
+            float depth = tileDepth[y * kTileSize + x];
+            block = float2(std::min(block.x, depth), std::max(block.y, depth));
+        }
+    }
+}
+
+/** Depth range of the primitive over the pixels in [pixelMin, pixelMax], every evaluatePixelDepth in the rect falls inside.
+ */
+static float2 evaluateDepthBounds(const TriangleSetup& setup, int2 pixelMin, int2 pixelMax, ConservativeMode mode) {
+    float2 absGrad = glm::abs(setup.gradDepth);
+    float depth = evaluateDepth(setup, (float2(pixelMin + pixelMax) + 1.f) * 0.5f);
+    float extent = dot(absGrad, float2(pixelMax - pixelMin) * 0.5f);
+    if (mode != ConservativeMode::None) extent += 0.5f * (absGrad.x + absGrad.y);
+
+    // Per pixel evaluation rounds differently, widen by a few ulps of the largest plane term
+    float2 d0 = glm::abs(float2(pixelMin) + 0.5f - float2(setup.vpCrd[0]));
+    float2 d1 = glm::abs(float2(pixelMax) + 0.5f - float2(setup.vpCrd[0]));
+    float magnitude = std::abs(setup.vpCrd[0].z) + dot(absGrad, glm::max(d0, d1));
+    extent += 4.f * std::numeric_limits<float>::epsilon() * magnitude;
+    return float2(depth - extent, depth + extent);
+}
+
+/** Depth test a primitive against a tile block by block, writePixel(pixel, local, depth) is called for samples that passed.
+ * Blocks entirely behind their farthest depth are skipped, blocks entirely in front of their nearest depth skip the depth reads.
+ */
+template <typename WritePixel>
+static void rasterizeTileBlocks(const TriangleSetup& setup, float3 coverageBias, ConservativeMode mode, int2 pixelMin, int2 pixelMax,
+                                int2 tileOrigin, int2 tileEnd, std::span<float> tileDepth, TileDepthBounds& bounds,
+                                PipelineCounters& counters, WritePixel&& writePixel) {
+    int2 blockMin = (pixelMin - tileOrigin) / kDepthBlockSize, blockMax = (pixelMax - tileOrigin) / kDepthBlockSize;
+    for (int by = blockMin.y; by <= blockMax.y; by++) {
+        for (int bx = blockMin.x; bx <= blockMax.x; bx++) {
+            float2& block = bounds[by * kDepthBlocksPerTile + bx];
+            int2 blockOrigin = tileOrigin + int2(bx, by) * kDepthBlockSize;
+            int2 blockLast = glm::min(blockOrigin + kDepthBlockSize, tileEnd) - 1;
+            int2 rectMin = glm::max(pixelMin, blockOrigin), rectMax = glm::min(pixelMax, blockLast);
+
+            // RHS + ZO depth, the smaller the closer
+            float2 depthRange = evaluateDepthBounds(setup, rectMin, rectMax, mode);
+            if (depthRange.x >= block.y) continue;
+            bool inRange = depthRange.x > 0 && depthRange.y <= 1;
+            bool accepted = inRange && depthRange.y < block.x;
+
+            int testedCount = 0;
+            float writtenNearest = std::numeric_limits<float>::infinity();
+            for (int y = rectMin.y; y <= rectMax.y; y++) {
+                for (int x = rectMin.x; x <= rectMax.x; x++) {
+                    if (!isPixelCovered(setup, int2(x, y), coverageBias)) continue;
+
+                    float depth = evaluatePixelDepth(setup, int2(x, y), mode);
+                    int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                    if (depth <= 0 || depth > 1) continue;
+                    testedCount++;
+                    if (!accepted && depth >= tileDepth[local]) continue;
+
+                    counters.fragmentsPassed++;
+                    tileDepth[local] = depth;
+                    writtenNearest = std::min(writtenNearest, depth);
+                    writePixel(int2(x, y), local, depth);
+                }
+            }
+            counters.fragmentsTested += testedCount;
+
+            // Samples keep the nearer of their old and the new depth, once every sample of the block was tested
+            // none of them is farther than the primitive
+            block.x = std::min(block.x, writtenNearest);
+            int2 blockSize = blockLast - blockOrigin + 1;
+            if (inRange && testedCount == blockSize.x * blockSize.y) block.y = std::min(block.y, depthRange.y);
+        }
+    }
+}
+
+void RasterPipeline::tiledBinning(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    ConservativeMode conservativeMode = mDesc.conservativeMode;
+    TileBins bins = binPrimitives(primitives, mTriangleSetups, width, height, mFrameArena);
+    mStatistics.local().drawnPrimitiveCount += bins.binnedPrimitiveCount;
+
+    // Rasterize tiles in parallel, each tile works on its own depth/color copy
+    Timer rasterTimer;
+    tbb::parallel_for(0, bins.tileCount(), [&](int tileIndex) {
+        uint32_t binBegin = bins.offsets[tileIndex], binEnd = bins.offsets[tileIndex + 1];
+        if (binBegin == binEnd) return;
+
+        int2 tileOrigin = int2(tileIndex % bins.tileCountX, tileIndex / bins.tileCountX) * kTileSize;
+        int2 tileEnd = glm::min(tileOrigin + int2(kTileSize), int2(width, height));
+
+        std::array<float, kTileSize * kTileSize> tileDepth;
+        std::array<float4, kTileSize * kTileSize> tileColor;
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        for (int y = tileOrigin.y; y < tileEnd.y; y++) {
+            for (int x = tileOrigin.x; x < tileEnd.x; x++) {
+                int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                tileDepth[local] = mpDepthTexture->fetch<float>(x, y);
+                tileColor[local] = mpColorTexture->fetch<float4>(x, y);
+            }
+        }
+        TileDepthBounds depthBounds;
+        initTileDepthBounds(tileDepth, tileEnd - tileOrigin, depthBounds);
+
+        for (uint32_t binIndex = binBegin; binIndex < binEnd; binIndex++) {
+            uint32_t primIndex = bins.indices[binIndex];
+            const auto& binned = bins.binned[primIndex];
+            const auto& setup = mTriangleSetups[primIndex];
+            float3 coverageBias = conservativeCoverageBias(setup, conservativeMode);
+            int2 pixelMin = glm::max(binned.pixelMin, tileOrigin);
+            int2 pixelMax = glm::min(binned.pixelMax, tileEnd - 1);
+
+            rasterizeTileBlocks(setup, coverageBias, conservativeMode, pixelMin, pixelMax, tileOrigin, tileEnd, tileDepth, depthBounds,
+                                batch.counters(), [&](int2 pixel, int local, float depth) {
+                                    FragIn fragIn;
+                                    GraphicsContextData context;
+                                    prepareFragment(setup, mAttributeSetups[primIndex], pixel, depth, fragIn, context);
+                                    batch.push(fragIn, context, &tileColor[local]);
+                                });
+        }
+        batch.flush();
+
+        // Flush the tile back to the framebuffer
+        for (int y = tileOrigin.y; y < tileEnd.y; y++) {
+            for (int x = tileOrigin.x; x < tileEnd.x; x++) {
+                int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                mpDepthTexture->fetch<float>(x, y) = tileDepth[local];
+                mpColorTexture->fetch<float4>(x, y) = tileColor[local];
+            }
+        }
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+static constexpr uint32_t kInvalidVisibility = ~0u;  ///< Visibility buffer texel not covered by this draw
+
+void RasterPipeline::visibilityBuffer(const std::vector<TrianglePrimitive>& primitives,
+                                      const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    ConservativeMode conservativeMode = mDesc.conservativeMode;
+    TileBins bins = binPrimitives(primitives, mTriangleSetups, width, height, mFrameArena);
+    mStatistics.local().drawnPrimitiveCount += bins.binnedPrimitiveCount;
+
+    mVisibilityBuffer.assign(size_t(width) * height, kInvalidVisibility);
+
+    // 1. Visibility pass, resolve the nearest primitive of every pixel with depth only, no attribute is touched
+    Timer rasterTimer;
+    tbb::parallel_for(0, bins.tileCount(), [&](int tileIndex) {
+        uint32_t binBegin = bins.offsets[tileIndex], binEnd = bins.offsets[tileIndex + 1];
+        if (binBegin == binEnd) return;
+
+        int2 tileOrigin = int2(tileIndex % bins.tileCountX, tileIndex / bins.tileCountX) * kTileSize;
+        int2 tileEnd = glm::min(tileOrigin + int2(kTileSize), int2(width, height));
+
+        std::array<float, kTileSize * kTileSize> tileDepth;
+        std::array<uint32_t, kTileSize * kTileSize> tileVisibility;
+        tileVisibility.fill(kInvalidVisibility);
+        PipelineCounters& counters = mStatistics.local();
+        for (int y = tileOrigin.y; y < tileEnd.y; y++) {
+            for (int x = tileOrigin.x; x < tileEnd.x; x++) {
+                tileDepth[(y - tileOrigin.y) * kTileSize + (x - tileOrigin.x)] = mpDepthTexture->fetch<float>(x, y);
+            }
+        }
+        TileDepthBounds depthBounds;
+        initTileDepthBounds(tileDepth, tileEnd - tileOrigin, depthBounds);
+
+        for (uint32_t binIndex = binBegin; binIndex < binEnd; binIndex++) {
+            uint32_t primIndex = bins.indices[binIndex];
+            const auto& binned = bins.binned[primIndex];
+            const auto& setup = mTriangleSetups[primIndex];
+            float3 coverageBias = conservativeCoverageBias(setup, conservativeMode);
+            int2 pixelMin = glm::max(binned.pixelMin, tileOrigin);
+            int2 pixelMax = glm::min(binned.pixelMax, tileEnd - 1);
+
+            rasterizeTileBlocks(setup, coverageBias, conservativeMode, pixelMin, pixelMax, tileOrigin, tileEnd, tileDepth, depthBounds,
+                                counters, [&](int2, int local, float) { tileVisibility[local] = primIndex; });
+        }
+
+        for (int y = tileOrigin.y; y < tileEnd.y; y++) {
+            for (int x = tileOrigin.x; x < tileEnd.x; x++) {
+                int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                mpDepthTexture->fetch<float>(x, y) = tileDepth[local];
+                mVisibilityBuffer[size_t(y) * width + x] = tileVisibility[local];
+            }
+        }
+    });
+
+    // 2. Resolve pass, interpolate attributes of the stored primitive and shade every visible pixel exactly once
+    tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int>& rows) {
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        for (int y = rows.begin(); y != rows.end(); y++) {
+            for (int x = 0; x < width; x++) {
+                uint32_t primIndex = mVisibilityBuffer[size_t(y) * width + x];
+                if (primIndex == kInvalidVisibility) continue;
+
+                const auto& setup = mTriangleSetups[primIndex];
+                const auto& attributes = mAttributeSetups[primIndex];
+                writeFragment(int2(x, y), setup, attributes, evaluatePixelDepth(setup, int2(x, y), conservativeMode), batch);
+            }
+        }
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+/** Depth in the high and payload in the low 32 bits, ordering of the packed words follows depth as NDC depth is never negative.
+ */
+static uint64_t packDepthPayload(float depth, uint32_t payload) { return (uint64_t(std::bit_cast<uint32_t>(depth)) << 32) | payload; }
+
+/** Lock-free 64-bit atomic min of a packed depth/payload word.
+ * @return true if the value was stored.
+ */
+static bool atomicMinPacked(uint64_t& target, uint64_t value) {
+    std::atomic_ref<uint64_t> ref(target);
+    uint64_t current = ref.load(std::memory_order_relaxed);
+    while (value < current) {
+        if (ref.compare_exchange_weak(current, value, std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+static constexpr uint32_t kPrimitiveParallelGrainSize = 64;  ///< Primitives rasterized serially by one task
+static constexpr uint32_t kSeedPayload = 0;                  ///< Payload of seeded pixels, primitive i stores i + 1 and loses ties
+
+void RasterPipeline::primitiveParallel(const std::vector<TrianglePrimitive>& primitives,
+                                       const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    ConservativeMode conservativeMode = mDesc.conservativeMode;
+
+    // Seed every pixel with the current depth and no primitive, a fragment at exactly the stored depth fails like a strict depth test
+    mPackedDepthBuffer.resize(size_t(width) * height);
+    tbb::parallel_for(0, height, [&](int y) {
+        for (int x = 0; x < width; x++) {
+            mPackedDepthBuffer[size_t(y) * width + x] = packDepthPayload(mpDepthTexture->fetch<float>(x, y), kSeedPayload);
+        }
+    });
+
+    // 1. Primitives rasterize concurrently, the nearest primitive of a pixel wins the atomic min, ties go to the lower index
+    Timer rasterTimer;
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, uint32_t(primitives.size()), kPrimitiveParallelGrainSize),
+                      [&](const tbb::blocked_range<uint32_t>& range) {
+                          PipelineCounters& counters = mStatistics.local();
+                          for (uint32_t primIndex = range.begin(); primIndex != range.end(); primIndex++) {
+                              const auto& setup = mTriangleSetups[primIndex];
+                              if (!setup.valid) continue;
+
+                              AABB aabb;
+                              for (const float3& p : setup.vpCrd) aabb |= p;
+                              if (isOutsideViewport(aabb, width, height)) continue;
+                              auto [pixelMin, pixelMax] = computePixelRange(aabb, width, height);
+                              float3 coverageBias = conservativeCoverageBias(setup, conservativeMode);
+                              counters.drawnPrimitiveCount++;
+
+                              for (int y = pixelMin.y; y <= pixelMax.y; y++) {
+                                  for (int x = pixelMin.x; x <= pixelMax.x; x++) {
+                                      if (!isPixelCovered(setup, int2(x, y), coverageBias)) continue;
+
+                                      float depth = evaluatePixelDepth(setup, int2(x, y), conservativeMode);
+                                      counters.fragmentsTested++;
+                                      if (depth <= 0 || depth > 1) continue;
+                                      uint64_t packed = packDepthPayload(depth, primIndex + 1);
+                                      if (atomicMinPacked(mPackedDepthBuffer[size_t(y) * width + x], packed)) counters.fragmentsPassed++;
+                                  }
+                              }
+                          }
+                      });
+
+    // 2. Resolve pass, unpack depth and shade the winning primitive of every pixel once
+    tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int>& rows) {
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        for (int y = rows.begin(); y != rows.end(); y++) {
+            for (int x = 0; x < width; x++) {
+                uint64_t packed = mPackedDepthBuffer[size_t(y) * width + x];
+                if (uint32_t(packed) == kSeedPayload) continue;
+                uint32_t primIndex = uint32_t(packed) - 1;
+
+                float depth = std::bit_cast<float>(uint32_t(packed >> 32));
+                mpDepthTexture->fetch<float>(x, y) = depth;
+                writeFragment(int2(x, y), mTriangleSetups[primIndex], mAttributeSetups[primIndex], depth, batch);
+            }
+        }
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+static constexpr int kSmallPrimitiveArea = 256;  ///< Max bounding box area in pixels of primitives rasterized by the small kernel
+
+void RasterPipeline::rasterizeSmallPrimitive(const TriangleSetup& setup, const TriangleAttributeSetup& attributes, int2 pixelMin,
+                                             int2 pixelMax, FragmentBatch& batch) {
+    PipelineCounters& counters = batch.counters();
+    for (int y = pixelMin.y; y <= pixelMax.y; y++) {
+        float* pDepthRow = mpDepthTexture->fetch<float>(0u, uint32_t(y)).ptr();
+        // Same plane terms as rasterizeSpan, so both kernels agree on coverage and depth
+        float sampleY = float(y) + 0.5f - setup.vpCrd[0].y;
+        float rowB1 = setup.gradB1.y * sampleY, rowB2 = setup.gradB2.y * sampleY;
+        float rowDepth = setup.vpCrd[0].z + setup.gradDepth.y * sampleY;
+        for (int x = pixelMin.x; x <= pixelMax.x; x++) {
+            float sampleX = float(x) + 0.5f - setup.vpCrd[0].x;
+            float b1 = rowB1 + sampleX * setup.gradB1.x;
+            float b2 = rowB2 + sampleX * setup.gradB2.x;
+            if (!isInsidePrimitive(float3(1.f - b1 - b2, b1, b2))) continue;
+
+            // RHS + ZO depth, the smaller the closer
+            float depth = rowDepth + sampleX * setup.gradDepth.x;
+            counters.fragmentsTested++;
+            if (depth <= 0 || depth > 1 || !(depth < pDepthRow[x])) continue;
+            pDepthRow[x] = depth;
+            counters.fragmentsPassed++;
+            writeFragment(int2(x, y), setup, attributes, depth, batch);
+        }
+    }
+}
+
+void RasterPipeline::rasterizeSizeClassified(const std::vector<TrianglePrimitive>& primitives, bool useHiZ,
+                                             const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+
+    // 1. Bin every primitive into screen tiles, the pyramid left by earlier draws culls occluded ones up front
+    TileBins bins = binPrimitives(primitives, mTriangleSetups, width, height, mFrameArena, useHiZ ? &mHiZBuffer : nullptr);
+    mStatistics.local().drawnPrimitiveCount += bins.binnedPrimitiveCount;
+    for (const auto& binned : bins.binned) {
+        if (!binned.visible) continue;
+        int2 extent = binned.pixelMax - binned.pixelMin + 1;
+        uint32_t area = uint32_t(extent.x) * uint32_t(extent.y);
+        mStats.primitiveSizeHistogram[std::min(int(std::bit_width(area) - 1) / 2, Stats::kSizeBucketCount - 1)]++;
+        if (useHiZ) mHiZBuffer.markDirty({uint2(binned.pixelMin), uint2(binned.pixelMax)});
+    }
+
+    // 2. Workers own whole tiles and walk their bin in depth sorted order, so ties resolve like the other modes.
+    // Primitives spanning several tiles are split into those tile jobs, small ones run the serial small kernel
+    Timer rasterTimer;
+    tbb::parallel_for(tbb::blocked_range<int>(0, bins.tileCount()), [&](const tbb::blocked_range<int>& tiles) {
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        for (int tileIndex = tiles.begin(); tileIndex != tiles.end(); tileIndex++) {
+            int2 tileOrigin = int2(tileIndex % bins.tileCountX, tileIndex / bins.tileCountX) * kTileSize;
+            for (uint32_t binIndex = bins.offsets[tileIndex]; binIndex < bins.offsets[tileIndex + 1]; binIndex++) {
+                uint32_t primIndex = bins.indices[binIndex];
+                const auto& binned = bins.binned[primIndex];
+                const auto& setup = mTriangleSetups[primIndex];
+                const auto& attributes = mAttributeSetups[primIndex];
+                int2 pixelMin = glm::max(binned.pixelMin, tileOrigin);
+                int2 pixelMax = glm::min(binned.pixelMax, tileOrigin + kTileSize - 1);
+                int2 extent = binned.pixelMax - binned.pixelMin + 1;
+                if (extent.x * extent.y <= kSmallPrimitiveArea) {
+                    rasterizeSmallPrimitive(setup, attributes, pixelMin, pixelMax, batch);
+                } else {
+                    for (int y = pixelMin.y; y <= pixelMax.y; y++) {
+                        rasterizeSpan(y, pixelMin.x, pixelMax.x, setup, attributes, batch);
+                    }
+                }
+            }
+        }
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
+}
+
+static constexpr uint32_t kCompressedPixel = ~0u;  ///< Multisampled pixel whose samples are all equal
+
+/** Standard MSAA sample positions inside the pixel, y points down as in viewport space.
+ */
+static std::array<float2, 8> standardSamplePositions(SampleCount sampleCount) {
+    // Offsets from the pixel center in 1/16 pixel units
+    static const std::array<int2, 1> k1x = {int2(0, 0)};
+    static const std::array<int2, 2> k2x = {int2(4, 4), int2(-4, -4)};
+    static const std::array<int2, 4> k4x = {int2(-2, -6), int2(6, -2), int2(-6, 2), int2(2, 6)};
+    static const std::array<int2, 8> k8x = {int2(1, -3), int2(-1, 3), int2(5, 1), int2(-3, -5),
+                                            int2(-5, 5), int2(-7, -1), int2(3, 7), int2(7, -7)};
+
+    std::span<const int2> offsets = k1x;
+    switch (sampleCount) {
+        case SampleCount::x1: offsets = k1x; break;
+        case SampleCount::x2: offsets = k2x; break;
+        case SampleCount::x4: offsets = k4x; break;
+        case SampleCount::x8: offsets = k8x; break;
+    }
+
+    std::array<float2, 8> positions{};
+    for (size_t i = 0; i < offsets.size(); i++) {
+        positions[i] = float2(0.5) + float2(offsets[i]) / 16.f;
+    }
+    return positions;
+}
+
+struct MultisampleScratch {
+    std::vector<float> depth;   ///< Expanded samples of the tile, sample count values per pixel
+    std::vector<float4> color;  ///< Expanded samples of the tile, sample count values per pixel
+};
+
+/** Shaded once per pixel, the color is broadcast to the covered samples after the batch is flushed.
+ */
+struct MultisampleFragment {
+    int local;
+    uint32_t sampleMask;
+    float4 color;
+};
+
+void RasterPipeline::multisampleTiled(const std::vector<TrianglePrimitive>& primitives,
+                                      const FragmentShaderBatch& fragmentShader) {
+    int width = mDesc.width;
+    int height = mDesc.height;
+    int sampleCount = int(mDesc.sampleCount);
+    std::array<float2, 8> samplePositions = standardSamplePositions(mDesc.sampleCount);
+    TileBins bins = binPrimitives(primitives, mTriangleSetups, width, height, mFrameArena);
+    mStatistics.local().drawnPrimitiveCount += bins.binnedPrimitiveCount;
+
+    if (mMultisampleTiles.size() != size_t(bins.tileCount())) {
+        mMultisampleTiles.assign(bins.tileCount(), MultisampleTile());
+    }
+
+    tbb::enumerable_thread_specific<MultisampleScratch> scratches;
+    Timer rasterTimer;
+    tbb::parallel_for(0, bins.tileCount(), [&](int tileIndex) {
+        uint32_t binBegin = bins.offsets[tileIndex], binEnd = bins.offsets[tileIndex + 1];
+        if (binBegin == binEnd) return;
+
+        int2 tileOrigin = int2(tileIndex % bins.tileCountX, tileIndex / bins.tileCountX) * kTileSize;
+        int2 tileEnd = glm::min(tileOrigin + int2(kTileSize), int2(width, height));
+        auto& tile = mMultisampleTiles[tileIndex];
+        auto& scratch = scratches.local();
+        scratch.depth.resize(kTileSize * kTileSize * sampleCount);
+        scratch.color.resize(kTileSize * kTileSize * sampleCount);
+
+        // 1. Expand the tile, pixels with equal samples broadcast their single sampled value
+        for (int y = tileOrigin.y; y < tileEnd.y; y++) {
+            for (int x = tileOrigin.x; x < tileEnd.x; x++) {
+                int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                float* pDepth = &scratch.depth[local * sampleCount];
+                float4* pColor = &scratch.color[local * sampleCount];
+                uint32_t slot = tile.pixelSlots.empty() ? kCompressedPixel : tile.pixelSlots[local];
+                if (slot == kCompressedPixel) {
+                    std::fill_n(pDepth, sampleCount, mpDepthTexture->fetch<float>(x, y));
+                    std::fill_n(pColor, sampleCount, mpColorTexture->fetch<float4>(x, y));
+                } else {
+                    std::copy_n(&tile.sampleDepth[size_t(slot) * sampleCount], sampleCount, pDepth);
+                    std::copy_n(&tile.sampleColor[size_t(slot) * sampleCount], sampleCount, pColor);
+                }
+            }
+        }
+
+        // 2. Test coverage and depth per sample, shade once per pixel for the samples that passed
+        std::array<MultisampleFragment, kFragmentBatchSize> fragments;
+        int fragmentCount = 0;
+        FragmentBatch batch(fragmentShader, mStatistics.local());
+        PipelineCounters& counters = batch.counters();
+        auto resolveFragments = [&]() {
+            batch.flush();
+            for (int i = 0; i < fragmentCount; i++) {
+                const auto& fragment = fragments[i];
+                for (int sample = 0; sample < sampleCount; sample++) {
+                    if (fragment.sampleMask & (1u << sample)) {
+                        scratch.color[fragment.local * sampleCount + sample] = fragment.color;
+                    }
+                }
+            }
+            fragmentCount = 0;
+        };
+
+        for (uint32_t binIndex = binBegin; binIndex < binEnd; binIndex++) {
+            uint32_t primIndex = bins.indices[binIndex];
+            const auto& binned = bins.binned[primIndex];
+            const auto& setup = mTriangleSetups[primIndex];
+            int2 pixelMin = glm::max(binned.pixelMin, tileOrigin);
+            int2 pixelMax = glm::min(binned.pixelMax, tileEnd - 1);
+
+            for (int y = pixelMin.y; y <= pixelMax.y; y++) {
+                for (int x = pixelMin.x; x <= pixelMax.x; x++) {
+                    int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                    float* pDepth = &scratch.depth[local * sampleCount];
+                    uint32_t sampleMask = 0;
+                    for (int sample = 0; sample < sampleCount; sample++) {
+                        float2 samplePoint = float2(x, y) + samplePositions[sample];
+                        if (!isInsidePrimitive(evaluateBarycentric(setup, samplePoint))) continue;
+
+                        float depth = evaluateDepth(setup, samplePoint);
+                        counters.fragmentsTested++;
+                        if (depth <= 0 || depth > 1 || depth >= pDepth[sample]) continue;
+
+                        counters.fragmentsPassed++;
+                        pDepth[sample] = depth;
+                        sampleMask |= 1u << sample;
+                    }
+                    if (sampleMask == 0) continue;
+
+                    // Pending colors are written in order, so a later fragment still wins the samples it covers
+                    if (fragmentCount == kFragmentBatchSize) resolveFragments();
+                    auto& fragment = fragments[fragmentCount++];
+                    fragment.local = local;
+                    fragment.sampleMask = sampleMask;
+
+                    FragIn fragIn;
+                    GraphicsContextData context;
+                    float centerDepth = evaluateDepth(setup, float2(x, y) + float2(0.5));
+                    prepareFragment(setup, mAttributeSetups[primIndex], int2(x, y), centerDepth, fragIn, context);
+                    batch.push(fragIn, context, &fragment.color);
+                }
+            }
+        }
+        resolveFragments();
+
+        // 3. Compress the tile and resolve it into the single sampled targets, only pixels with differing samples keep a slot
+        tile.sampleDepth.clear();
+        tile.sampleColor.clear();
+        for (int y = tileOrigin.y; y < tileEnd.y; y++) {
+            for (int x = tileOrigin.x; x < tileEnd.x; x++) {
+                int local = (y - tileOrigin.y) * kTileSize + (x - tileOrigin.x);
+                const float* pDepth = &scratch.depth[local * sampleCount];
+                const float4* pColor = &scratch.color[local * sampleCount];
+                bool samplesEqual = true;
+                for (int sample = 1; sample < sampleCount && samplesEqual; sample++) {
+                    samplesEqual = pDepth[sample] == pDepth[0] && pColor[sample] == pColor[0];
+                }
+
+                if (samplesEqual) {
+                    if (!tile.pixelSlots.empty()) tile.pixelSlots[local] = kCompressedPixel;
+                    mpDepthTexture->fetch<float>(x, y) = pDepth[0];
+                    mpColorTexture->fetch<float4>(x, y) = pColor[0];
+                    continue;
+                }
+
+                if (tile.pixelSlots.empty()) tile.pixelSlots.assign(kTileSize * kTileSize, kCompressedPixel);
+                tile.pixelSlots[local] = uint32_t(tile.sampleDepth.size() / sampleCount);
+                tile.sampleDepth.insert(tile.sampleDepth.end(), pDepth, pDepth + sampleCount);
+                tile.sampleColor.insert(tile.sampleColor.end(), pColor, pColor + sampleCount);
+
+                // Resolve to the average color and the farthest depth, which keeps the depth conservative for occlusion tests
+                float4 color(0.f);
+                float depth = pDepth[0];
+                for (int sample = 0; sample < sampleCount; sample++) {
+                    color += pColor[sample];
+                    depth = std::max(depth, pDepth[sample]);
+                }
+                mpDepthTexture->fetch<float>(x, y) = depth;
+                mpColorTexture->fetch<float4>(x, y) = color / float(sampleCount);
+            }
+        }
+        if (tile.sampleDepth.empty()) tile.pixelSlots.clear();
+    });
+    rasterTimer.end();
+    mStats.primitiveRasterizeTime += rasterTimer.elapsedMilliseconds();
 }
 
-}  // namespace Rastery
\ No newline at end of file
+}  // namespace Rastery
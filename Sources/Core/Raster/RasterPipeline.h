@@ -1,15 +1,20 @@
 #pragma once
-#include <tbb/concurrent_vector.h>
 
-#include <atomic>
+#include <array>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
 
 #include "Core/API/BVH.h"
 #include "Core/API/Texture.h"
 #include "Core/API/Vao.h"
 #include "Core/Enum.h"
 #include "Core/Macros.h"
+#include "Core/Raster/FrameArena.h"
+#include "Core/Raster/HiZBuffer.h"
+#include "Core/Raster/PipelineStatistics.h"
 
 namespace Rastery {
 
@@ -30,11 +35,17 @@ struct VertexOut {
     friend VertexOut operator*(float scalar, const VertexOut& vertex);
 };
 
+/** Triangle referencing its vertices in the post-transform vertex cache of the pipeline.
+ */
 struct TrianglePrimitive {
     uint32_t id;  ///< primitive index, actually primitive index in Vao
-    VertexOut v0;
-    VertexOut v1;
-    VertexOut v2;
+    const VertexOut* pV0;
+    const VertexOut* pV1;
+    const VertexOut* pV2;
+
+    [[nodiscard]] const VertexOut& v0() const { return *pV0; }
+    [[nodiscard]] const VertexOut& v1() const { return *pV1; }
+    [[nodiscard]] const VertexOut& v2() const { return *pV2; }
 };
 
 struct EdgeItem {
@@ -43,30 +54,70 @@ struct EdgeItem {
     float x;   ///< Edge upper vertex start x
     float dx;  ///< dx = 1 / k
     int dy;    ///< scanline count across the edge
+    int y;     ///< First scanline of the edge
+};
+
+/** Hot per-primitive data produced by triangle setup, read for every sample the primitive covers.
+ * Barycentric weights and depth are affine functions of the viewport position relative to vpCrd[0].
+ */
+struct alignas(64) TriangleSetup {
+    std::array<float3, 3> vpCrd;  ///< Viewport coordinates, z keeps the NDC depth
+    float2 gradB1;                ///< Gradient of the v1 weight in viewport space
+    float2 gradB2;                ///< Gradient of the v2 weight in viewport space
+    float2 gradDepth;             ///< Gradient of the NDC depth in viewport space
+    bool valid;                   ///< False if the primitive is degenerate in viewport space
+};
+
+/** Cold per-primitive attribute planes, only touched by fragments that passed depth test.
+ * attribute(p) = base + ddx * (p.x - vpCrd[0].x) + ddy * (p.y - vpCrd[0].y), rasterPosition holds NDC xy, depth and clip space w.
+ */
+struct TriangleAttributeSetup {
+    uint32_t primitiveId;
+    VertexOut base;
+    VertexOut ddx;
+    VertexOut ddy;
+};
+
+/** Multisampled depth/color storage of one screen tile.
+ * Pixels whose samples are all equal live only in the single sampled targets, the others own a slot of sample values.
+ */
+struct MultisampleTile {
+    std::vector<uint32_t> pixelSlots;  ///< Sample slot of every tile pixel, empty while all samples of the tile are equal
+    std::vector<float> sampleDepth;    ///< Sample count depth values per slot
+    std::vector<float4> sampleColor;   ///< Sample count color values per slot
 };
 
 struct RasterizerDebugData {
+    /** Values copied out of an edge item, the primitive vertices it points to do not outlive the draw.
+     */
     struct DebugEdgeItem {
-        TrianglePrimitive primitive;
-        float x0;  ///< Edge upper vertex start x
-        float dx;  ///< dx = 1 / k
-        int dy;    ///< scanline count across the edge
+        uint32_t primitiveId;  ///< Primitive index in Vao
+        float x0;              ///< Edge upper vertex start x
+        float dx;              ///< dx = 1 / k
+        int dy;                ///< scanline count across the edge
         DebugEdgeItem() = default;
-        DebugEdgeItem(const EdgeItem& item) : primitive(*item.pPrimitive), x0(item.x0), dx(item.dx), dy(item.dy) {}
+        DebugEdgeItem(const EdgeItem& item) : primitiveId(item.pPrimitive->id), x0(item.x0), dx(item.dx), dy(item.dy) {}
     } activeEdgePair[2];
 };
 
-/** General graphics context data.
+/** General graphics context data, built for every fragment so it is kept small.
+ * Pixel debug data is not part of it, see RasterPipeline::setDebugPixel.
  */
 struct GraphicsContextData {
     // Rasterization context
     uint32_t primitiveId;
     float2 sampleCrd;
+    const TriangleAttributeSetup* pAttributes;  ///< Attribute planes of the primitive, valid while the draw shades it
 
-    // Debug
-    RasterizerDebugData debugData;
+    GraphicsContextData() = default;
+    GraphicsContextData(const TriangleAttributeSetup& attributes, float2 sampleCrd)
+        : primitiveId(attributes.primitiveId), sampleCrd(sampleCrd), pAttributes(&attributes) {}
 
-    GraphicsContextData(uint32_t primId, float2 sampleCrd) : primitiveId(primId), sampleCrd(sampleCrd) {}
+    /** Analytic screen space derivatives of the fragment attributes per pixel, the plane gradients of the primitive.
+     * rasterPosition ones follow the FragIn layout: NDC xy, depth and clip space w.
+     */
+    [[nodiscard]] const VertexOut& ddx() const { return pAttributes->ddx; }
+    [[nodiscard]] const VertexOut& ddy() const { return pAttributes->ddy; }
 };
 
 using FragIn = VertexOut;
@@ -74,6 +125,14 @@ using FragIn = VertexOut;
 using VertexShader = std::function<VertexOut(Vertex)>;
 using FragmentShader = std::function<float4(const FragIn&, const GraphicsContextData&)>;
 
+/** Batched shader entries used inside the pipeline, every raster path reaches the shaders through these.
+ * They stay type erased, the user shader can only be inlined into the loop over a batch, not into the raster loops.
+ */
+using VertexShaderBatch = std::function<void(std::span<const Vertex>, std::span<VertexOut>)>;
+using FragmentShaderBatch = std::function<void(std::span<const FragIn>, std::span<const GraphicsContextData>, std::span<float4>)>;
+
+class FragmentBatch;
+
 enum class CullMode { BackFace, FrontFace, None };
 
 RASTERY_ENUM_INFO(CullMode, {
@@ -85,40 +144,88 @@ RASTERY_ENUM_INFO(CullMode, {
 RASTERY_ENUM_REGISTER(CullMode)
 
 enum class RasterMode {
-    Naive,            ///< Very slow
-    BoundedNaive,     ///< Faster naive per primitive drawing
-    ScanLineZBuffer,  ///< Scan line z-buffer with AET
+    Naive,              ///< Very slow
+    BoundedNaive,       ///< Faster naive per primitive drawing
+    ScanLineZBuffer,    ///< Scan line z-buffer with AET
+    TiledBinning,       ///< Bin primitives into screen tiles, rasterize tiles in parallel
+    HalfSpace,          ///< Fixed-point edge functions with incremental stepping and top-left fill rule
+    IntervalScanLine,   ///< Span based interval scan line, resolves visibility per interval without z-buffer
+    VisibilityBuffer,   ///< Rasterize primitive ids first, shade every visible pixel once in a resolve pass
+    PrimitiveParallel,  ///< Rasterize primitives concurrently with 64-bit atomic min on packed depth and primitive id
 };
 
 RASTERY_ENUM_INFO(RasterMode, {
                                   {RasterMode::Naive, "Naive"},
                                   {RasterMode::BoundedNaive, "BoundedNaive"},
                                   {RasterMode::ScanLineZBuffer, "ScanLineZBuffer"},
+                                  {RasterMode::TiledBinning, "TiledBinning"},
+                                  {RasterMode::HalfSpace, "HalfSpace"},
+                                  {RasterMode::IntervalScanLine, "IntervalScanLine"},
+                                  {RasterMode::VisibilityBuffer, "VisibilityBuffer"},
+                                  {RasterMode::PrimitiveParallel, "PrimitiveParallel"},
                               })
 
 RASTERY_ENUM_REGISTER(RasterMode)
 
+enum class SampleCount { x1 = 1, x2 = 2, x4 = 4, x8 = 8 };
+
+RASTERY_ENUM_INFO(SampleCount, {
+                                   {SampleCount::x1, "1x"},
+                                   {SampleCount::x2, "2x"},
+                                   {SampleCount::x4, "4x"},
+                                   {SampleCount::x8, "8x"},
+                               })
+
+RASTERY_ENUM_REGISTER(SampleCount)
+
+enum class ConservativeMode {
+    None,           ///< Pixel is covered if its center is inside the primitive
+    OverEstimate,   ///< Pixel is covered if the primitive touches any part of it, depth is the nearest over the pixel
+    UnderEstimate,  ///< Pixel is covered only if the primitive covers all of it, depth is the farthest over the pixel
+};
+
+RASTERY_ENUM_INFO(ConservativeMode, {
+                                        {ConservativeMode::None, "None"},
+                                        {ConservativeMode::OverEstimate, "OverEstimate"},
+                                        {ConservativeMode::UnderEstimate, "UnderEstimate"},
+                                    })
+
+RASTERY_ENUM_REGISTER(ConservativeMode)
+
 struct RasterDesc {
     // We actually mixup framebuffer and raster state here
     int width;
     int height;
     CullMode cullMode = CullMode::BackFace;
     RasterMode rasterMode = RasterMode::BoundedNaive;
+    SampleCount sampleCount = SampleCount::x1;                   ///< MSAA sample count, multisampled draws are always rasterized in tiles
+    ConservativeMode conservativeMode = ConservativeMode::None;  ///< Conservative coverage, see RasterPipeline::supportsConservativeRaster
 
     bool useHierarchicalZBuffer = true;     ///< Enable HiZ for primitive culling
     bool useAccelerationStructure = false;  ///< Enable spatial acceleration structure
+    bool writeIntervalDepth = false;        ///< Interval scan line writes its resolved depth, for occlusion queries and later draws
 };
 
 class RASTERY_API RasterPipeline {
    public:
     struct Stats {
-        uint32_t commitedPrimitiveCount = 0;            ///< Triangle primitive count.(after back/front facing cull)
-        uint32_t drawCallCount = 0;                     ///< Time of draw call count.
-        float fullRasterizeTime = 0;                    ///< Rasterization time in ms.
-        float accelerationTime = 0;                     ///< Time consumed by acceleration techniques.
-        std::atomic<float> primitiveRasterizeTime = 0;  ///< Time consumed by primitive rasterize.
-
-        std::atomic_uint32_t actualDrawCount = 0u;  ///< The actually draw primitive count
+        uint32_t commitedPrimitiveCount = 0;  ///< Triangle primitive count.(after back/front facing cull)
+        uint32_t drawCallCount = 0;           ///< Time of draw call count.
+        float vertexShaderTime = 0;           ///< Vertex shading, clipping and primitive assembly time in ms.
+        float primitiveSortTime = 0;          ///< Primitive depth sort time in ms.
+        float fullRasterizeTime = 0;          ///< Rasterization time in ms.
+        float triangleSetupTime = 0;          ///< Triangle setup time in ms.
+        float accelerationTime = 0;           ///< BVH refit and Hi-Z pyramid preparation/update time in ms.
+        float primitiveRasterizeTime = 0;     ///< Raster stage time in ms, includes the Hi-Z/BVH culling tests interleaved with it.
+
+        // Reduced from the per-thread counters by endFrame()
+        uint64_t actualDrawCount = 0u;  ///< The actually draw primitive count
+        uint64_t fragmentsTested = 0u;  ///< Covered samples that reached the depth test
+        uint64_t fragmentsPassed = 0u;  ///< Samples that passed the depth test
+        uint64_t fragmentsShaded = 0u;  ///< Fragment shader invocations
+
+        static constexpr int kSizeBucketCount = 8;
+        std::array<uint32_t, kSizeBucketCount> primitiveSizeHistogram{};  ///< Bounding box area histogram, bucket i starts at 4^i pixels
     };
 
     using SharedPtr = std::shared_ptr<RasterPipeline>;
@@ -130,6 +237,33 @@ class RASTERY_API RasterPipeline {
 
     void beginFrame();
 
+    /** Reduce the per-thread counters of the frame into the stats.
+     */
+    void endFrame();
+
+    /** Capture rasterizer debug data for a single pixel, a negative coordinate disables capture.
+     * Only the scan line z-buffer mode records debug data.
+     */
+    void setDebugPixel(int2 pixel) { mDebugPixel = pixel; }
+
+    /** Debug data of the last fragment written to the debug pixel in this frame.
+     * @return false if nothing was captured.
+     */
+    bool getDebugData(RasterizerDebugData& debugData) const;
+
+    /** Test world space boxes against the depth rasterized so far in the frame, nothing is drawn.
+     * Call between draws from the thread driving the pipeline, the boxes are tested in parallel.
+     *
+     * @param boxes World space boxes
+     * @param viewProjection Transform from world to clip space, usually the one the vertex shader used
+     * @param visibility Resized to one bit per box, bit i % 64 of word i / 64 is set if box i may be visible
+     */
+    void queryOcclusion(std::span<const AABB> boxes, const float4x4& viewProjection, std::vector<uint64_t>& visibility);
+
+    /** Same as above for boxes already in viewport space, xy in pixels and z in NDC depth.
+     */
+    void queryOcclusion(std::span<const AABB> viewportBoxes, std::vector<uint64_t>& visibility);
+
     /** Execute rasterization pipeline.
      *
      * @param vao CPU vertex array object data
@@ -137,45 +271,163 @@ class RASTERY_API RasterPipeline {
      */
     void draw(const CpuVao& vao, BVH& bvh, VertexShader vertexShader, FragmentShader fragmentShader);
 
+    /** Execute rasterization pipeline with concrete shader types, wrapped into batch loops the compiler can inline them in.
+     * The raster paths are not specialized on the shaders, they call a batch through one indirect call per batch.
+     * VertexShaderT: VertexOut(Vertex), FragmentShaderT: float4(const FragIn&, const GraphicsContextData&).
+     */
+    template <typename VertexShaderT, typename FragmentShaderT>
+    void draw(const CpuVao& vao, BVH& bvh, const VertexShaderT& vertexShader, const FragmentShaderT& fragmentShader) {
+        auto shadeVertices = [&vertexShader](std::span<const Vertex> vertices, std::span<VertexOut> outs) {
+            for (size_t i = 0; i < vertices.size(); i++) outs[i] = vertexShader(vertices[i]);
+        };
+        auto shadeFragments = [&fragmentShader](std::span<const FragIn> fragIns, std::span<const GraphicsContextData> contexts,
+                                                std::span<float4> colors) {
+            for (size_t i = 0; i < fragIns.size(); i++) colors[i] = fragmentShader(fragIns[i], contexts[i]);
+        };
+        drawBatched(vao, bvh, shadeVertices, shadeFragments);
+    }
+
     void renderUI();
 
     bool useHiZ() const;
 
     bool useAccelerationStructure() const;
 
+    /** Conservative coverage is only implemented by tiled binning and the deferred paths, single sampled.
+     */
+    bool supportsConservativeRaster() const;
+
    private:
     Stats mStats;
 
+    void drawBatched(const CpuVao& vao, BVH& bvh, const VertexShaderBatch& vertexShader, const FragmentShaderBatch& fragmentShader);
+
     void renderStats() const;
 
-    bool earlyHiZBufferTest(const AABB& vpBounds) const;
+    /** Sort primitives front to back by their nearest vertex, a parallel radix sort of (depth key, index) pairs.
+     */
+    void sortPrimitives(std::vector<TrianglePrimitive>& primitives);
 
-    bool earlyHiZBufferTest(const AABB& vpBounds, int layer) const;
+    /** Bring the Hi-Z pyramid up to date with the depth target, rebuilding it if a previous draw did not maintain it.
+     */
+    void prepareHiZBuffer();
 
-    /** Down-top update hierarchical z-buffer pyramid in the range.
+    /** Propagate the pending Hi-Z updates once a batch of primitives has been written, or whenever some are pending if forced.
      */
-    void cascadeUpdateHiZBuffer(std::pair<uint2, uint2> range);
+    void updateHiZBuffer(bool force = false);
 
     bool zBufferTest(float2 sample, float depth);
 
     /** Vertex shader for projection misc.
      */
-    [[nodiscard]] tbb::concurrent_vector<TrianglePrimitive> executeVertexShader(const CpuVao& vao, VertexShader vertexShader) const;
+    [[nodiscard]] std::vector<TrianglePrimitive>& executeVertexShader(const CpuVao& vao, const VertexShaderBatch& vertexShader);
+
+    /** Compute triangle setup records of all primitives, indexed the same as the primitive list.
+     */
+    void setupTriangles(const std::vector<TrianglePrimitive>& primitives);
+
+    /** Rasterize primitives one after another, specialized on raster mode and Hi-Z culling.
+     */
+    template <RasterMode kRasterMode, bool kUseHiZ>
+    void rasterizePrimitives(const std::vector<TrianglePrimitive>& primitives, BVH& bvh,
+                             const FragmentShaderBatch& fragmentShader);
+
+    template <RasterMode kRasterMode, bool kUseHiZ>
+    void rasterizePrimitive(const TriangleSetup& setup, const TriangleAttributeSetup& attributes,
+                            const FragmentShaderBatch& fragmentShader);
+
+    /** Rasterize the primitive by stepping fixed-point edge functions across its bounding box.
+     */
+    void rasterizeHalfSpace(const TriangleSetup& setup, const TriangleAttributeSetup& attributes,
+                            const FragmentShaderBatch& fragmentShader);
+
+    void rasterizePoint(int2 pixel, const TriangleSetup& setup, const TriangleAttributeSetup& attributes, FragmentBatch& batch,
+                        const RasterizerDebugData* pDebugData = nullptr);
+
+    /** Rasterize pixels [xBegin, xEnd] of row y in 4-wide blocks, coverage and depth test are vectorized.
+     */
+    void rasterizeSpan(int y, int xBegin, int xEnd, const TriangleSetup& setup, const TriangleAttributeSetup& attributes,
+                       FragmentBatch& batch);
 
-    void rasterizePrimitive(const TrianglePrimitive& primitive, FragmentShader fragmentShader);
+    /** Rasterize a small primitive inside [pixelMin, pixelMax] with a scalar loop, no span or lane setup.
+     */
+    void rasterizeSmallPrimitive(const TriangleSetup& setup, const TriangleAttributeSetup& attributes, int2 pixelMin, int2 pixelMax,
+                                 FragmentBatch& batch);
 
-    void rasterizePoint(int2 pixel, std::span<const float3, 3> viewportCrds, const TrianglePrimitive& primitive,
-                        FragmentShader fragmentShader, RasterizerDebugData* pDebugData = nullptr);
+    /** BoundedNaive scheduling by primitive size, every primitive is binned into screen tiles kept in depth order.
+     * Small primitives run the serial small kernel in their tile, larger ones are split into tile jobs of 4-wide spans.
+     */
+    void rasterizeSizeClassified(const std::vector<TrianglePrimitive>& primitives, bool useHiZ,
+                                 const FragmentShaderBatch& fragmentShader);
 
-    void prepareRasterization(const tbb::concurrent_vector<TrianglePrimitive>& primitives, BVH& bvh);
+    /** Depth test a covered pixel, attributes are interpolated and shaded only if it passes.
+     */
+    void shadeFragment(int2 pixel, const TriangleSetup& setup, const TriangleAttributeSetup& attributes, FragmentBatch& batch,
+                       const RasterizerDebugData* pDebugData = nullptr);
 
-    void executeRasterization(const tbb::concurrent_vector<TrianglePrimitive>& primitives, BVH& bvh, FragmentShader fragmentShader);
+    /** Interpolate a fragment that passed depth test and queue it for shading, the color is written when the batch is flushed.
+     */
+    void writeFragment(int2 pixel, const TriangleSetup& setup, const TriangleAttributeSetup& attributes, float depth, FragmentBatch& batch,
+                       const RasterizerDebugData* pDebugData = nullptr);
 
-    void scanlineZBuffer(const tbb::concurrent_vector<TrianglePrimitive>& primitives, FragmentShader fragmentShader);
+    void prepareRasterization(const std::vector<TrianglePrimitive>& primitives, BVH& bvh);
+
+    void executeRasterization(const std::vector<TrianglePrimitive>& primitives, BVH& bvh,
+                              const FragmentShaderBatch& fragmentShader);
+
+    void scanlineZBuffer(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader);
+
+    /** Interval scan line, intervals are split where the depth order of their spans changes.
+     * The depth buffer is never tested, the resolved depth is only written if RasterDesc::writeIntervalDepth is set.
+     */
+    void intervalScanline(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader);
+
+    /** Bin primitives into fixed-size screen tiles and rasterize every tile independently.
+     * Each tile owns a local depth/color buffer, so no two workers ever touch the same pixel.
+     */
+    void tiledBinning(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader);
+
+    /** Deferred shading, the first pass writes the nearest primitive index and depth per pixel,
+     * the second pass interpolates attributes and runs the fragment shader once for every covered pixel.
+     */
+    void visibilityBuffer(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader);
+
+    /** Deferred shading without binning, primitives rasterize concurrently into a packed depth/primitive id buffer,
+     * each pixel update is a lock-free 64-bit atomic min, the resolve pass shades every covered pixel once.
+     */
+    void primitiveParallel(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader);
+
+    /** Tiled MSAA, coverage and depth are tested per sample while the fragment shader runs once per pixel.
+     * Every touched tile is compressed and resolved into the single sampled depth/color targets at the end of the draw.
+     */
+    void multisampleTiled(const std::vector<TrianglePrimitive>& primitives, const FragmentShaderBatch& fragmentShader);
 
     RasterDesc mDesc;
 
-    std::vector<CpuTexture::SharedPtr> mHiZDepthTextures;
+    FrameArena mFrameArena;          ///< Per frame temporaries of all draws, reset in beginFrame
+    PipelineStatistics mStatistics;  ///< Per-thread counters, reduced in endFrame
+
+    // Persistent grow-only buffers, reused across draws and frames
+    std::vector<VertexOut> mTransformedVertices;         ///< Post-transform vertex cache, one entry per Vao vertex
+    std::vector<VertexOut> mClippedVertices;             ///< Vertices generated by clipping, sized once per draw so addresses are stable
+    std::vector<uint8_t> mPolygonSizes;                  ///< Per Vao primitive clip result of the assembly count pass
+    std::vector<TrianglePrimitive> mPrimitives;          ///< Assembled primitives of the current draw
+    std::vector<TrianglePrimitive> mSortedPrimitives;    ///< Sort gather target, swapped with mPrimitives
+    std::vector<uint64_t> mPrimitiveSortKeys;            ///< Depth key and primitive index pairs, kept across draws
+    std::vector<uint64_t> mPrimitiveSortScratch;         ///< Radix sort ping-pong buffer
+    std::vector<TriangleSetup> mTriangleSetups;
+    std::vector<TriangleAttributeSetup> mAttributeSetups;
+    std::vector<int> mClippedPrimitiveLinks;         ///< Next primitive clipped from the same Vao primitive, -1 terminated
+    std::vector<uint32_t> mVisibilityBuffer;         ///< Per pixel visible primitive index, kept across draws to avoid reallocation
+    std::vector<uint64_t> mPackedDepthBuffer;        ///< Per pixel depth in the high and primitive index in the low 32 bits
+    std::vector<MultisampleTile> mMultisampleTiles;  ///< Compressed MSAA samples, kept across draws and reset every frame
+    HiZBuffer mHiZBuffer;                            ///< Min/max depth pyramid, kept across the draws of a frame
+
+    // Pixel debug capture, written by workers under the mutex
+    int2 mDebugPixel = int2(-1, -1);
+    mutable std::mutex mDebugMutex;
+    RasterizerDebugData mDebugData;
+    bool mDebugDataValid = false;
     CpuTexture::SharedPtr mpDepthTexture;
     CpuTexture::SharedPtr mpColorTexture;
 };
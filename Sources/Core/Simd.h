@@ -0,0 +1,102 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+
+#include "Core/Macros.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTERY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Rastery {
+/** 4-wide float vector for the raster kernels.
+ * Comparisons return per-lane masks (all bits set or clear) that can be combined with & and |.
+ * Maps to SSE2 on x86, falls back to plain scalar lanes elsewhere.
+ */
+struct SimdFloat4 {
+#if RASTERY_SSE2
+    __m128 v;
+
+    SimdFloat4() = default;
+    SimdFloat4(__m128 value) : v(value) {}
+    SimdFloat4(float s) : v(_mm_set1_ps(s)) {}
+    SimdFloat4(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+
+    static SimdFloat4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    /** Bit i is set if lane i of the mask is set.
+     */
+    [[nodiscard]] int moveMask() const { return _mm_movemask_ps(v); }
+
+    friend SimdFloat4 operator+(SimdFloat4 a, SimdFloat4 b) { return _mm_add_ps(a.v, b.v); }
+    friend SimdFloat4 operator-(SimdFloat4 a, SimdFloat4 b) { return _mm_sub_ps(a.v, b.v); }
+    friend SimdFloat4 operator*(SimdFloat4 a, SimdFloat4 b) { return _mm_mul_ps(a.v, b.v); }
+    friend SimdFloat4 operator/(SimdFloat4 a, SimdFloat4 b) { return _mm_div_ps(a.v, b.v); }
+    friend SimdFloat4 operator<(SimdFloat4 a, SimdFloat4 b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend SimdFloat4 operator<=(SimdFloat4 a, SimdFloat4 b) { return _mm_cmple_ps(a.v, b.v); }
+    friend SimdFloat4 operator>(SimdFloat4 a, SimdFloat4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+    friend SimdFloat4 operator>=(SimdFloat4 a, SimdFloat4 b) { return _mm_cmpge_ps(a.v, b.v); }
+    friend SimdFloat4 operator&(SimdFloat4 a, SimdFloat4 b) { return _mm_and_ps(a.v, b.v); }
+    friend SimdFloat4 operator|(SimdFloat4 a, SimdFloat4 b) { return _mm_or_ps(a.v, b.v); }
+    friend SimdFloat4 min(SimdFloat4 a, SimdFloat4 b) { return _mm_min_ps(a.v, b.v); }
+    friend SimdFloat4 max(SimdFloat4 a, SimdFloat4 b) { return _mm_max_ps(a.v, b.v); }
+
+    /** Per-lane mask ? valueIfSet : valueIfClear.
+     */
+    friend SimdFloat4 select(SimdFloat4 mask, SimdFloat4 valueIfSet, SimdFloat4 valueIfClear) {
+        return _mm_or_ps(_mm_and_ps(mask.v, valueIfSet.v), _mm_andnot_ps(mask.v, valueIfClear.v));
+    }
+#else
+    float v[4];
+
+    SimdFloat4() = default;
+    SimdFloat4(float s) : v{s, s, s, s} {}
+    SimdFloat4(float x, float y, float z, float w) : v{x, y, z, w} {}
+
+    static SimdFloat4 load(const float* p) { return {p[0], p[1], p[2], p[3]}; }
+    void store(float* p) const {
+        for (int i = 0; i < 4; i++) p[i] = v[i];
+    }
+
+    [[nodiscard]] int moveMask() const {
+        int mask = 0;
+        for (int i = 0; i < 4; i++) mask |= int(std::bit_cast<uint32_t>(v[i]) >> 31) << i;
+        return mask;
+    }
+
+    template <typename Op>
+    static SimdFloat4 apply(SimdFloat4 a, SimdFloat4 b, Op op) {
+        SimdFloat4 r;
+        for (int i = 0; i < 4; i++) r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+
+    static float toMask(bool b) { return std::bit_cast<float>(b ? 0xffffffffu : 0u); }
+
+    friend SimdFloat4 operator+(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+    friend SimdFloat4 operator-(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+    friend SimdFloat4 operator*(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+    friend SimdFloat4 operator/(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+    friend SimdFloat4 operator<(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return toMask(x < y); }); }
+    friend SimdFloat4 operator<=(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return toMask(x <= y); }); }
+    friend SimdFloat4 operator>(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return toMask(x > y); }); }
+    friend SimdFloat4 operator>=(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return toMask(x >= y); }); }
+    friend SimdFloat4 operator&(SimdFloat4 a, SimdFloat4 b) {
+        return apply(a, b, [](float x, float y) { return std::bit_cast<float>(std::bit_cast<uint32_t>(x) & std::bit_cast<uint32_t>(y)); });
+    }
+    friend SimdFloat4 operator|(SimdFloat4 a, SimdFloat4 b) {
+        return apply(a, b, [](float x, float y) { return std::bit_cast<float>(std::bit_cast<uint32_t>(x) | std::bit_cast<uint32_t>(y)); });
+    }
+    friend SimdFloat4 min(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return y < x ? y : x; }); }
+    friend SimdFloat4 max(SimdFloat4 a, SimdFloat4 b) { return apply(a, b, [](float x, float y) { return x < y ? y : x; }); }
+
+    friend SimdFloat4 select(SimdFloat4 mask, SimdFloat4 valueIfSet, SimdFloat4 valueIfClear) {
+        return (mask & valueIfSet) | apply(mask, valueIfClear, [](float m, float x) {
+                   return std::bit_cast<float>(~std::bit_cast<uint32_t>(m) & std::bit_cast<uint32_t>(x));
+               });
+    }
+#endif
+};
+}  // namespace Rastery
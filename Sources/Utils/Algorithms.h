@@ -1,6 +1,12 @@
 #pragma once
 
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <functional>
+#include <vector>
 namespace Rastery {
 template <typename T, typename Compare>
 void sort3(T& v0, T& v1, T& v2, Compare cmp) {
@@ -15,4 +21,69 @@ void sort3(T& v0, T& v1, T& v2, Compare cmp) {
     }
 }
 
-}  // namespace Rastery
\ No newline at end of file
+/** Map a float to an uint32_t with the same ordering, negative values included.
+ */
+inline uint32_t floatToOrderedUint(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    return bits ^ ((bits >> 31) ? ~0u : 0x80000000u);
+}
+
+/** Stable parallel LSD radix sort of 64-bit items by their high 32 bits, the low 32 bits are carried along as payload.
+ * Items with equal keys keep their input order.
+ *
+ * @param items Items to sort in place.
+ * @param scratch Temporary storage, resized to the item count.
+ */
+inline void parallelRadixSortByHighBits(std::vector<uint64_t>& items, std::vector<uint64_t>& scratch) {
+    constexpr int kRadixBits = 8;
+    constexpr uint32_t kBucketCount = 1u << kRadixBits;
+    constexpr size_t kBlockSize = size_t(1) << 14;  ///< Items counted and scattered by one task
+
+    size_t count = items.size();
+    scratch.resize(count);
+    size_t blockCount = (count + kBlockSize - 1) / kBlockSize;
+    std::vector<uint32_t> offsets(blockCount * kBucketCount);
+
+    uint64_t* pSrc = items.data();
+    uint64_t* pDst = scratch.data();
+    for (int shift = 32; shift < 64; shift += kRadixBits) {
+        // 1. Digit histogram of every block
+        std::fill(offsets.begin(), offsets.end(), 0u);
+        tbb::parallel_for(size_t(0), blockCount, [&](size_t block) {
+            uint32_t* pOffsets = &offsets[block * kBucketCount];
+            for (size_t i = block * kBlockSize, end = std::min(count, i + kBlockSize); i < end; i++) {
+                pOffsets[(pSrc[i] >> shift) & (kBucketCount - 1)]++;
+            }
+        });
+
+        // 2. Exclusive prefix sum in digit major, block minor order, keeps the sort stable
+        uint32_t offset = 0;
+        bool singleDigit = false;
+        for (uint32_t digit = 0; digit < kBucketCount; digit++) {
+            uint32_t digitBegin = offset;
+            for (size_t block = 0; block < blockCount; block++) {
+                uint32_t n = offsets[block * kBucketCount + digit];
+                offsets[block * kBucketCount + digit] = offset;
+                offset += n;
+            }
+            singleDigit |= offset - digitBegin == count;
+        }
+        // All items share this digit, the pass would not move anything
+        if (singleDigit) continue;
+
+        // 3. Scatter every block to its digit offsets
+        tbb::parallel_for(size_t(0), blockCount, [&](size_t block) {
+            uint32_t* pOffsets = &offsets[block * kBucketCount];
+            for (size_t i = block * kBlockSize, end = std::min(count, i + kBlockSize); i < end; i++) {
+                pDst[pOffsets[(pSrc[i] >> shift) & (kBucketCount - 1)]++] = pSrc[i];
+            }
+        });
+        std::swap(pSrc, pDst);
+    }
+
+    if (pSrc != items.data()) {
+        items.swap(scratch);
+    }
+}
+
+}  // namespace Rastery